@@ -4,576 +4,5416 @@
 #include <dirent.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
 #include <time.h>
+#include <limits.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <pthread.h>
+#include <poll.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
+// Traces hold raw byte addresses and are paged at simulation time, so one
+// trace can be replayed under any page size. PAGE_SIZE is the default and
+// the smallest supported; binary trace files record 4K page numbers.
 #define PAGE_SIZE 4096
-#define PHYSICAL_MEMORY_SIZE_24BIT (1 << 24)
-#define PHYSICAL_MEMORY_SIZE_20BIT (1 << 20)
-#define MAX_TRACE_ENTRIES 1000000
+#define MIN_PAGE_SHIFT 12
+#define MAX_PAGE_SHIFT 30
+#define TRACE_CHUNK_ENTRIES 65536
+#define NEVER_USED LLONG_MAX
+// Frame and node numbers are ints, and ARC and CLOCK-Pro keep up to
+// 2 * frames + 2 page nodes, so frame counts stop at half of INT_MAX.
+#define MAX_FRAMES ((INT_MAX - 2) / 2)
+// Page numbers are 64-bit throughout; this marks an empty frame.
+#define PAGE_NONE UINT64_MAX
+
+// Traces of several processes share one simulation: every entry carries
+// an address-space id, and page keys hold it above the page number, so
+// the processes' pages never collide while competing for the same frames.
+#define ASID_SHIFT 48
+#define MAX_ASIDS (1 << 16)
+#define PAGE_KEY_MASK ((1ULL << ASID_SHIFT) - 1)
+
+// Live /proc collection: pages expanded per process and the number of
+// references each process runs before the merged trace moves on.
+#define PROCESS_TRACE_PAGES 100
+#define PROCESS_TRACE_QUANTUM 64
+
+// Binary trace files: a 32-byte little-endian header followed by one
+// LEB128 varint per reference holding (zigzag(page delta) << 1) | is_store.
+// Pages are page keys, so the top bits carry the ASID.
+// The varint holds up to 65 bits, so a record takes at most 10 bytes.
+#define TRACE_FILE_MAGIC "VMTRACE"
+#define TRACE_FILE_VERSION 1
+#define TRACE_FILE_HEADER_SIZE 32
+#define TRACE_OP_LOW_BIT 1
+#define TRACE_RECORD_MAX_BYTES 10
+
+// Lookahead modes for policies that need future references (MIN).
+#define LOOKAHEAD_NONE 0
+#define LOOKAHEAD_WINDOW 1
+#define LOOKAHEAD_TWO_PASS 2
+
+// Live capture through perf_event: precise (PEBS) load and store samples
+// with their data address where the CPU exposes mem-loads/mem-stores,
+// otherwise every user page fault with its faulting address. Rings are
+// kept small enough for the default unprivileged mlock allowance.
+#define CAPTURE_RING_PAGES 32
+#define CAPTURE_SAMPLE_PERIOD 101
+#define CAPTURE_POLL_MS 100
+#define PERF_PMU_PATH "/sys/bus/event_source/devices/cpu"
+
+// Idle page tracking: the page_idle bitmap holds one bit per PFN, read and
+// written in 64-bit words, and pagemap maps a virtual page to its PFN.
+#define PAGE_IDLE_BITMAP "/sys/kernel/mm/page_idle/bitmap"
+#define PAGEMAP_PRESENT (1ULL << 63)
+#define PAGEMAP_PFN_MASK ((1ULL << 55) - 1)
+#define IDLE_INTERVAL_MS 1000
 
 typedef struct {
     char operation;
-    unsigned long address;
+    uint16_t asid;
+    uint64_t address;
 } TraceEntry;
 
-TraceEntry trace[MAX_TRACE_ENTRIES];
+static inline uint64_t trace_page(const TraceEntry* entry, int page_shift) {
+    return ((entry->address >> page_shift) & PAGE_KEY_MASK) | ((uint64_t)entry->asid << ASID_SHIFT);
+}
+
+TraceEntry* trace = NULL;
 int trace_size = 0;
+int trace_capacity = 0;
 
+// The processes behind a multi-process trace, indexed by ASID.
 typedef struct {
-    int page_number;
-    int frame_number;
-    int referenced;
-    int valid;
-} PageTableEntry;
+    pid_t pid;
+    char command[16];
+    long long references;
+} ProcessInfo;
+
+ProcessInfo* trace_processes = NULL;
+int trace_process_count = 0;
+
+const char* algorithm_names[] = {"FIFO", "LRU", "MIN", "SECOND CHANCE", "CLOCK", "ARC", "2Q", "LIRS", "CLOCK-PRO",
+                                 "NRU", "ENHANCED SC"};
+#define NUM_ALGORITHMS 11
+
+// Estimated cost of servicing faults, in microseconds: a fault on a load
+// reads the page in, a fault on a store also reads it in (the rest of the
+// page has to come from disk), and evicting a dirty page writes it out first.
+typedef struct {
+    double read;
+    double write;
+    double write_back;
+} FaultLatency;
+
+FaultLatency fault_latency = {100, 100, 250};
+
+// Keys are 64-bit page numbers, values 32-bit frame (or node) numbers,
+// kept in separate arrays so a probe only touches the keys it compares.
+typedef struct {
+    uint64_t* keys;
+    int* frames;
+    size_t capacity;
+    size_t mask;
+    int shift;
+    int count;
+} PageIndex;
 
+// Per-frame state as parallel byte arrays; the page held by a frame lives
+// in PhysicalMemory::frames and the page-to-frame map in index.
 typedef struct {
-    PageTableEntry* entries;
+    uint8_t* referenced;
+    uint8_t* dirty;
+    uint8_t* valid;
+    PageIndex* index;
     int size;
-    int page_faults;
-    int hits;
-    int misses;
+    long long page_faults;
+    long long hits;
+    long long misses;
+    long long read_faults;
+    long long write_faults;
+    long long write_backs;
+    // Per-ASID faults and evictions, kept only for multi-process traces.
+    long long* asid_faults;
+    long long* asid_evictions;
+    int asid_count;
 } PageTable;
 
 typedef struct {
-    int* frames;
+    uint64_t* frames;
     int size;
     int next_frame;
 } PhysicalMemory;
 
 typedef struct {
-    int* pages;
     int* frames;
     int size;
     int next_index;
 } FIFOQueue;
 
+// Recency list threaded through the frame array: prev/next hold frame
+// numbers, head is the most recently used frame and tail the least.
 typedef struct {
-    int* pages;
     int* frames;
-    int* ages;
+    int* prev;
+    int* next;
+    int head;
+    int tail;
     int size;
 } LRUQueue;
 
+// CLOCK: the frames form a circle and the hand sweeps it, clearing
+// reference bits until it finds a frame whose bit is already clear.
 typedef struct {
-    int* pages;
     int* frames;
     int* reference_bits;
     int size;
     int hand;
 } ClockQueue;
 
+// Second Chance: frames in load order in a ring buffer. The oldest frame
+// is evicted unless its reference bit is set, in which case the bit is
+// cleared and the frame goes back to the tail as if newly loaded.
 typedef struct {
-    int* pages;
-    int* frames;
+    int* queue;
     int* reference_bits;
+    int head;
+    int count;
     int size;
-    int hand;
 } SecondChanceQueue;
 
+// NRU: frames are ranked by class 2R + M from their reference and dirty
+// bits, and the victim is a frame of the lowest class present. Reference
+// bits are all cleared every NRU_TICK references, as a timer interrupt
+// would; the scan starts after the last victim so ties rotate. dirty is
+// the page table's, lent through set_dirty_bits. Prefetch loads reach the
+// policy through on_miss like faults do, so they count towards the tick.
+#define NRU_TICK 1000
+
+typedef struct {
+    int* reference_bits;
+    const uint8_t* dirty;
+    int size;
+    int hand;
+    int references;
+} NruQueue;
+
+// Enhanced second chance: CLOCK over (R, M) pairs. The hand first looks
+// for an unreferenced clean frame without touching any bit, then for an
+// unreferenced dirty one while clearing reference bits, and repeats; a
+// clean victim is preferred because it costs no write-back.
+typedef struct {
+    int* reference_bits;
+    const uint8_t* dirty;
+    int size;
+    int hand;
+} EnhancedClockQueue;
+
+// Belady's MIN: resident frames sit in a max-heap keyed by the trace index
+// of their page's next reference, looked up in the next_use array that is
+// precomputed with one backward pass over the trace.
+typedef struct {
+    int* heap;
+    int* position;
+    long long* frame_next_use;
+    long long* next_use;
+    int count;
+    int size;
+} MinQueue;
+
+// Doubly-linked list of node ids; head is the most recent end. The links
+// live in prev/next arrays passed in, so a node can sit on one list per
+// pair of link arrays.
+typedef struct {
+    int head;
+    int tail;
+    int length;
+} NodeList;
+
+// Page nodes for the policies that remember more pages than there are
+// frames. index maps a page to its node, whether resident or a ghost;
+// frame_nodes maps a frame to its resident node for the hit path. lists
+// records which of the policy's lists holds each node (-1 for none), and
+// free nodes are chained through next.
+typedef struct {
+    uint64_t* pages;
+    int* frames;
+    int* lists;
+    int* prev;
+    int* next;
+    int* frame_nodes;
+    PageIndex* index;
+    int free_node;
+    int capacity;
+} PageNodes;
+
+#define ARC_T1 0
+#define ARC_T2 1
+#define ARC_B1 2
+#define ARC_B2 3
+
+// ARC (Megiddo and Modha): T1 holds pages referenced once recently, T2
+// pages referenced at least twice, and the ghost lists B1 and B2 remember
+// pages recently evicted from each. A ghost hit shifts the target size of
+// T1 toward the side that would have kept the page.
+typedef struct {
+    PageNodes* nodes;
+    NodeList lists[4];
+    int target;
+    int size;
+    int pending;
+    int pending_list;
+    int evict_t1;
+} ArcQueue;
+
+#define TWOQ_A1IN 0
+#define TWOQ_AM 1
+#define TWOQ_A1OUT 2
+
+// 2Q (Johnson and Shasha): new pages enter the FIFO A1in; pages evicted
+// from it are remembered in the ghost FIFO A1out, and only a reference
+// found there promotes a page into the LRU list Am. One-time scans pass
+// through A1in without disturbing Am.
+typedef struct {
+    PageNodes* nodes;
+    NodeList lists[3];
+    int in_limit;
+    int out_limit;
+    int size;
+    int pending;
+} TwoQQueue;
+
+#define LIRS_LIR 0
+#define LIRS_HIR 1
+#define LIRS_GHOST 2
+#define LIRS_STACK 0
+#define LIRS_QUEUE 0
+#define LIRS_GHOSTS 1
+
+// LIRS (Jiang and Zhang): pages are ranked by inter-reference recency.
+// Most frames hold LIR pages; the rest hold HIR pages, kept in queue Q in
+// eviction order. The recency stack S holds LIR pages and recently seen
+// HIR pages, resident or not; an HIR page referenced again while still in
+// S becomes LIR and the LIR page at the bottom of S is demoted. Stack
+// links are the node links, the queue and the ghost age list use a second
+// set so a page can be on S and on Q at once.
+typedef struct {
+    PageNodes* nodes;
+    NodeList stack;
+    NodeList queues[2];
+    int* queue_prev;
+    int* queue_next;
+    int* queue_lists;
+    int* status;
+    int lir_count;
+    int lir_limit;
+    int ghost_limit;
+    int size;
+    int pending;
+} LirsQueue;
+
+// CLOCK-Pro (Jiang, Chen and Zhang): CLOCK with LIRS-style hot and cold
+// pages on one circular list. HAND_cold evicts cold pages, HAND_hot demotes
+// hot ones, and HAND_test ends the test periods of cold pages, during
+// which an evicted page is remembered as non-resident. The cold target
+// grows when a non-resident page is re-referenced and shrinks when a test
+// period passes unused.
+typedef struct {
+    PageNodes* nodes;
+    int* hot;
+    int* reference_bits;
+    int* test;
+    int hand_hot;
+    int hand_cold;
+    int hand_test;
+    int hot_count;
+    int nonresident_count;
+    int cold_target;
+    int size;
+    int pending;
+    int evicting;
+} ClockProQueue;
+
+// Optional address-translation model: a two-level set-associative TLB in
+// front of a radix page table with a page-walk cache. Each level of the
+// table resolves 9 bits of the 4K virtual page number; larger pages end
+// the walk 9 bits (one level) earlier per step, so 2M pages map at the
+// third level and 1G pages at the second. Cycle costs are rough Skylake
+// figures and only feed the per-access estimate.
+#define TLB_L1_ENTRIES 64
+#define TLB_L1_WAYS 4
+#define TLB_L2_ENTRIES 1536
+#define TLB_L2_WAYS 12
+#define PAGE_TABLE_LEVELS 4
+#define MAX_PAGE_TABLE_LEVELS 5
+#define PAGE_TABLE_INDEX_BITS 9
+#define PWC_ENTRIES 32
+#define TLB_L1_CYCLES 1
+#define TLB_L2_CYCLES 7
+#define WALK_REFERENCE_CYCLES 25
+
+// Set-associative cache of page keys with LRU replacement inside a set;
+// an empty way holds PAGE_NONE. Also used for each page-walk cache level.
+typedef struct {
+    uint64_t* tags;
+    uint64_t* stamps;
+    int sets;
+    int ways;
+    uint64_t clock;
+} Tlb;
+
+typedef struct {
+    int l1_entries;
+    int l1_ways;
+    int l2_entries;
+    int l2_ways;
+    int levels;
+} TranslationConfig;
+
+// pwc[k] caches the level-k entries (k >= 2) that point to level k - 1
+// tables, keyed like the table they point to. nodes[k] records every
+// level-k table the walks have needed, to size the page table.
+typedef struct {
+    Tlb l1;
+    Tlb l2;
+    Tlb pwc[MAX_PAGE_TABLE_LEVELS + 1];
+    PageIndex* nodes[MAX_PAGE_TABLE_LEVELS + 1];
+    int levels;
+    int leaf_level;
+    int page_shift;
+    long long accesses;
+    long long l1_hits;
+    long long l2_hits;
+    long long walks;
+    long long walk_references;
+    long long pwc_hits;
+    long long cycles;
+} TranslationModel;
+
+// Prefetching on a fault. The prefetcher sees the faults the policy would
+// take without it, that is every demand fault plus the first use of each
+// prefetched page, and names up to degree pages to load with it:
+// sequential readahead the pages after the fault, stride the next steps of
+// a distance seen twice in a row between faults, and Markov the pages that
+// faulted right after this one before. Pages are stepped within their ASID.
+#define PREFETCH_NONE 0
+#define PREFETCH_SEQUENTIAL 1
+#define PREFETCH_STRIDE 2
+#define PREFETCH_MARKOV 3
+#define PREFETCH_DEGREE 4
+#define PREFETCH_MAX_DEGREE 64
+#define MARKOV_ENTRIES_LOG 16
+
+typedef struct {
+    int kind;
+    int degree;
+} PrefetchConfig;
+
+// prefetched marks the frames loaded by a prefetch and not yet used. The
+// Markov table is direct-mapped: tags[slot] is a page and successors holds
+// the degree pages that faulted after it, most recent first. Pages evicted
+// to make room for a prefetch are remembered, the last frame-count of them
+// in a ring, so that a later fault on one counts as pollution.
+typedef struct {
+    int kind;
+    int degree;
+    uint8_t* prefetched;
+    uint64_t last_fault;
+    int64_t stride;
+    uint64_t* tags;
+    uint64_t* successors;
+    PageIndex* displaced;
+    uint64_t* displaced_ring;
+    int displaced_size;
+    int displaced_next;
+    uint64_t candidates[PREFETCH_MAX_DEGREE];
+    long long issued;
+    long long useful;
+    long long unused;
+    long long pollution;
+} Prefetcher;
+
+// A replacement policy as seen by the simulation engine. The engine owns the
+// page table and frame bookkeeping and calls into the policy's state:
+// on_hit for a resident page, on_miss before a victim is needed,
+// choose_victim once memory is full, on_insert after the page is loaded.
+// set_lookahead (NULL unless the policy needs the future) lends the
+// next-use array for the trace about to be simulated; set_dirty_bits
+// (NULL unless the policy looks at them) lends the page table's per-frame
+// dirty bits once, when the simulator is built. simulate is the
+// policy's own copy of the simulation loop, built by DEFINE_SIMULATION_LOOP
+// with the hooks inlined; when NULL the engine calls the hooks indirectly.
+struct Simulator;
+
+typedef struct {
+    void* (*create)(int frames);
+    void (*free)(void* state);
+    void (*on_hit)(void* state, int frame, int step);
+    void (*on_miss)(void* state, uint64_t page, int step);
+    int (*choose_victim)(void* state);
+    void (*on_insert)(void* state, int frame, uint64_t page, int step);
+    void (*set_lookahead)(void* state, long long* next_use);
+    void (*set_dirty_bits)(void* state, const uint8_t* dirty);
+    void (*simulate)(struct Simulator* sim, TraceEntry* trace, int trace_size);
+} ReplacementPolicy;
+
+typedef struct Simulator {
+    PageTable* pt;
+    PhysicalMemory* pm;
+    int page_shift;
+    const ReplacementPolicy* policy;
+    void* state;
+    TranslationModel* translation;
+    Prefetcher* prefetcher;
+    long long* next_use;
+    // When set, steps[i] receives reference i of the trace being simulated
+    // as STEP_RECORD(frame, hit, loaded): the frame that then holds the
+    // page, the hit bit, and the loaded bit, set on a fault and on the first
+    // use of a prefetched page. A fault's victim is always in the frame the
+    // page goes to. MAX_FRAMES keeps frame numbers within 30 bits.
+    uint32_t* steps;
+} Simulator;
+
+#define STEP_RECORD(frame, hit, loaded) ((uint32_t)(frame) << 2 | (uint32_t)(loaded) << 1 | (uint32_t)(hit))
+#define STEP_FRAME(record) ((int)((record) >> 2))
+#define STEP_HIT(record) ((int)((record) & 1))
+#define STEP_LOADED(record) ((int)((record) >> 1 & 1))
+
+// Heat and counters saved from the step log, one set after every interval
+// steps, so the animation can reach any step by restoring the one at or
+// before it and replaying the log from there. Their number is bounded by
+// CHECKPOINT_BUDGET at four bytes of heat per frame, and may be 0 for very
+// large memories.
+#define CHECKPOINT_MIN_INTERVAL 1024
+#define CHECKPOINT_BUDGET (256ll << 20)
+
+typedef struct {
+    uint32_t* heat;      // frames entries per checkpoint; checkpoint k is before step (k + 1) * interval
+    long long* hits;
+    long long* misses;
+    int count;
+    int interval;
+    int frames;
+} Checkpoints;
+
+// Indexed by algorithm id, in the same order as algorithm_names.
+extern const ReplacementPolicy* const policies[NUM_ALGORITHMS];
+
+// Stack-distance histogram for a stack algorithm: distance_counts[d] is the
+// number of references found at depth d (1-based), so a memory of k frames
+// hits every reference with distance <= k. One pass yields every size.
+typedef struct {
+    long long* distance_counts;
+    int max_frames;
+    long long references;
+} MissCurve;
+
+// Reuse intervals for the OPT curve. The trace is cut into pieces, and a
+// reuse holds its page across pieces [from, to); floor[k] is the number of
+// pages that every memory still in question keeps across piece k.
+typedef struct {
+    int* from;
+    int* to;
+    int count;
+    int* floor;
+    int pieces;
+} ReuseSet;
+
+// Range-add, range-max segment tree over the pieces of a ReuseSet.
+typedef struct {
+    int* highest;
+    int* pending;
+} LoadTree;
+
+// Variable-space allocation: instead of a fixed frame count the resident
+// set follows the program's locality (see run_resident_set_allocator).
+#define ALLOCATOR_WORKING_SET 0
+#define ALLOCATOR_PFF 1
+#define RESIDENT_SAMPLE_REFERENCES 1000
+
+typedef struct {
+    int kind;
+    long long tau;
+} AllocatorConfig;
+
+// The resident pages are page nodes on one recency list, most recent at
+// the head; last_use is indexed by node. The sample counters cover the
+// current curve interval, and frames (0 when no memory size was given) is
+// the memory a mean resident set must exceed to count as thrashing.
+typedef struct {
+    int kind;
+    long long tau;
+    int frames;
+    PageNodes* nodes;
+    NodeList resident;
+    long long* last_use;
+    long long time;
+    long long last_fault;
+    long long faults;
+    long long resident_sum;
+    int max_resident;
+    long long sample_start;
+    long long sample_faults;
+    long long sample_resident;
+    long long thrashing_start;
+    long long thrashing_faults;
+    int thrashing_intervals;
+} ResidentSetAllocator;
+
+// Per-access events, buffered and flushed in batches so the simulation loop
+// itself never does I/O. Verbosity picks which kinds are echoed as text;
+// a binary sink, when open, receives every event as a raw AccessEvent.
+#define EVENT_HIT 0
+#define EVENT_MISS 1
+#define EVENT_EVICT 2
+#define EVENT_WRITEBACK 3
+#define EVENT_PREFETCH 4
+#define EVENT_BUFFER_ENTRIES 8192
+#define EVENT_FILE_MAGIC "VMEVENT"
+#define LOG_QUIET 0
+#define LOG_FAULTS 1
+#define LOG_ACCESSES 2
+
+typedef struct {
+    int64_t step;
+    uint64_t page;
+    int32_t frame;
+    int32_t kind;
+} AccessEvent;
+
+typedef struct {
+    AccessEvent* events;
+    int count;
+    int level;
+    FILE* binary;
+    long long step_base;
+} EventLog;
+
+// NULL unless -v or --events was given, which keeps the hot path to one
+// pointer test.
+EventLog* event_log = NULL;
+
+// One (policy, page size, memory size) run in compare mode.
+typedef struct {
+    int algorithm;
+    int frames;
+    int page_shift;
+    long long* next_use;
+    long long hits;
+    long long misses;
+    long long page_faults;
+    long long write_backs;
+    double io_seconds;
+    long long tlb_misses;
+    double cycles_per_access;
+    int prefetching;
+    long long prefetches;
+    double prefetch_accuracy;
+    double prefetch_coverage;
+    double seconds;
+} ComparisonJob;
+
+// Work queue shared by the compare-mode threads. The trace and one
+// next-use array per page size are built once and only read by the workers.
+typedef struct {
+    ComparisonJob* jobs;
+    int job_count;
+    int next_job;
+    pthread_mutex_t lock;
+    TraceEntry* trace;
+    int trace_size;
+    const TranslationConfig* translation;
+    const PrefetchConfig* prefetch;
+} ComparisonPool;
+
+typedef struct {
+    FILE* file;
+    unsigned long long count;
+    uint64_t last_page;
+    unsigned int page_size;
+} TraceWriter;
+
+// Bounded-memory source of trace chunks, read from the in-memory trace, a
+// text trace file or an mmap'd binary trace. With lookahead enabled every
+// chunk also carries next_use: the global index of each entry's next
+// reference. A tee writer, when set, receives every chunk handed out.
+// Quiet streams end at a malformed binary record without a warning.
+typedef struct {
+    FILE* file;
+    const unsigned char* mapped;
+    size_t mapped_size;
+    size_t cursor;
+    unsigned long long mapped_remaining;
+    uint64_t last_page;
+    unsigned int mapped_page_size;
+    int quiet;
+    int page_shift;
+    TraceWriter* tee;
+    TraceEntry* memory;
+    int memory_size;
+    long long* memory_next_use;
+    TraceEntry* buffer;
+    int buffered;
+    TraceEntry* chunk;
+    long long* next_use;
+    int chunk_size;
+    int chunk_capacity;
+    long long position;
+    int lookahead;
+    int window;
+    PageIndex* scratch;
+    FILE* spill;
+    FILE* spill_next_use;
+} TraceStream;
+
+// One perf event and its sample ring: a metadata page followed by a
+// power-of-two data area the kernel fills and we drain.
+typedef struct {
+    int fd;
+    struct perf_event_mmap_page* ring;
+    size_t ring_size;
+    size_t data_size;
+    char operation;
+} CaptureEvent;
+
+// Events are opened per CPU for the target task with inherit set, so
+// threads and children it creates later are sampled too.
+typedef struct {
+    CaptureEvent* events;
+    int event_count;
+    pid_t pid;
+    int spawned;
+    const char* backend;
+    unsigned long long samples;
+    unsigned long long lost;
+} CaptureSession;
+
+typedef struct {
+    pid_t pid;
+    char command[16];
+    uint16_t asid;
+    TraceEntry* entries;
+    int count;
+    int capacity;
+} ProcessTrace;
+
+// The --processes list, split into PIDs and command names before the scan
+// workers start; the names point into text.
+typedef struct {
+    char* text;
+    pid_t* pids;
+    int pid_count;
+    const char** names;
+    int name_count;
+} ProcessFilter;
+
+typedef struct {
+    ProcessTrace* processes;
+    int process_count;
+    int next_process;
+    pthread_mutex_t lock;
+    const ProcessFilter* filter;
+} ProcessScanPool;
+
+typedef struct {
+    uint64_t pfn;
+    uint64_t address;
+} IdlePage;
+
+// The resident pages of one sampled process, sorted by PFN.
+typedef struct {
+    pid_t pid;
+    uint16_t asid;
+    IdlePage* pages;
+    int count;
+    int capacity;
+} IdleTarget;
+
+// Visualizer text. Printable ASCII is rasterised once into a white glyph
+// atlas, and strings are drawn from it as tinted quads, queued and handed
+// to the renderer in batches. Text that never changes is rendered once into
+// a Label texture of its own.
+#define GLYPH_FIRST 32
+#define GLYPH_LAST 126
+#define GLYPH_COUNT (GLYPH_LAST - GLYPH_FIRST + 1)
+#define GLYPH_ATLAS_COLUMNS 16
+#define GLYPH_BATCH 1024
+
+typedef struct {
+    SDL_Texture* texture;
+    SDL_Rect glyphs[GLYPH_COUNT];
+    int advance[GLYPH_COUNT];
+    int width;
+    int height;
+    int line_height;
+    SDL_Vertex vertices[GLYPH_BATCH * 4];
+    int quad_count;
+} GlyphAtlas;
+
+typedef struct {
+    SDL_Texture* texture;
+    int w;
+    int h;
+} Label;
+
+// The animation's view of physical memory. Frames sit in a grid that can
+// be zoomed and panned; cells are batched by colour, and those outside the
+// view are skipped. Once cells shrink below GRID_MIN_CELL pixels the grid
+// becomes a texture with one pixel per frame, of which only the pixels of
+// frames touched since the last draw are uploaded.
+#define FRAME_VIEW_X 0
+#define FRAME_VIEW_Y 60
+#define FRAME_VIEW_WIDTH 1000
+#define FRAME_VIEW_HEIGHT 730
+#define GRID_MIN_CELL 4
+#define GRID_BORDER_CELL 8
+#define GRID_LABEL_CELL 40
+#define HEATMAP_MAX_SIDE 8192
+
+#define FRAME_EMPTY 0
+#define FRAME_RESIDENT 1
+#define FRAME_HIT 2
+#define FRAME_MISS 3
+#define FRAME_CLASSES 4
+
+typedef struct {
+    int frames;
+    int columns;
+    int rows;
+    double base_scale;   // Cell pitch in pixels at zoom 1
+    double zoom;
+    double pan_x;        // Grid origin within the view area
+    double pan_y;
+    int heatmap_only;
+    SDL_Rect* cells[FRAME_CLASSES];
+    int cell_counts[FRAME_CLASSES];
+    int cell_capacity;
+    SDL_Texture* heatmap;
+    uint32_t* pixels;
+    int* touched;
+    uint8_t* is_touched;
+    int touched_count;
+    int refresh;
+    int highlight;
+    int highlight_hit;
+} FrameView;
+
+// The animation replays the headless pass's step log on a worker thread,
+// which hands the UI snapshots through three buffers: the worker fills
+// one, the UI draws another, and the third, the latest complete snapshot,
+// is swapped with an atomic exchange by either side. The worker only
+// publishes once the UI has taken the previous snapshot, so the UI sees
+// every change list in turn.
+#define SNAPSHOT_FRESH 4
+#define SNAPSHOT_TOUCHED_MAX 4096
+#define WORKER_BATCH 65536
+
+typedef struct {
+    int step;
+    long long hits;
+    long long misses;
+    int last_frame;
+    int last_hit;
+    uint32_t* heat;      // Accesses since the frame's page was loaded, 0 when empty
+    int* touched;        // Frames changed since the previous snapshot
+    int touched_count;
+    int refresh;         // Set when too much changed to list
+} SimulationSnapshot;
+
+typedef struct {
+    const uint32_t* steps;     // STEP_RECORDs of the headless pass
+    int trace_size;
+    int frames;
+    Checkpoints* checkpoints;  // Optional; without them seeking back replays from step 0
+    pthread_t thread;
+    SimulationSnapshot snapshots[3];
+    int back;            // Worker's buffer
+    int ready;           // Latest snapshot, with SNAPSHOT_FRESH until the UI takes it
+    int front;           // UI's buffer
+    int target;          // Step the UI wants shown
+    int quit;
+    // Worker state since the last publish
+    int step;
+    long long hits;
+    long long misses;
+    int last_frame;
+    int last_hit;
+    uint32_t* heat;
+    int* touched;
+    uint8_t* is_touched;
+    int touched_count;
+    int refresh;
+    int pending;
+} SimulationWorker;
+
 PageTable* create_page_table(int size);
+PageIndex* create_page_index(int size);
 PhysicalMemory* create_physical_memory(int size);
 FIFOQueue* create_fifo_queue(int size);
 LRUQueue* create_lru_queue(int size);
 ClockQueue* create_clock_queue(int size);
 SecondChanceQueue* create_second_chance_queue(int size);
+MinQueue* create_min_queue(int size);
+MissCurve* create_miss_curve(int max_frames);
+PageNodes* create_page_nodes(int capacity, int frames);
+ArcQueue* create_arc_queue(int size);
+TwoQQueue* create_twoq_queue(int size);
+LirsQueue* create_lirs_queue(int size);
+ClockProQueue* create_clock_pro_queue(int size);
+NruQueue* create_nru_queue(int size);
+EnhancedClockQueue* create_enhanced_clock_queue(int size);
 void free_page_table(PageTable* pt);
+void page_table_track_asids(PageTable* pt, int asid_count);
+void free_page_index(PageIndex* index);
+int page_index_lookup(PageIndex* index, uint64_t page_number);
+void page_index_insert(PageIndex* index, uint64_t page_number, int frame_number);
+void page_index_remove(PageIndex* index, uint64_t page_number);
 void free_physical_memory(PhysicalMemory* pm);
 void free_fifo_queue(FIFOQueue* fifo);
 void free_lru_queue(LRUQueue* lru);
 void free_clock_queue(ClockQueue* clock);
 void free_second_chance_queue(SecondChanceQueue* sc);
+void free_min_queue(MinQueue* min);
+void free_miss_curve(MissCurve* curve);
+void free_page_nodes(PageNodes* nodes);
+void free_arc_queue(ArcQueue* arc);
+void free_twoq_queue(TwoQQueue* twoq);
+void free_lirs_queue(LirsQueue* lirs);
+void free_clock_pro_queue(ClockProQueue* cp);
+void free_nru_queue(NruQueue* nru);
+void free_enhanced_clock_queue(EnhancedClockQueue* clock);
+int page_nodes_alloc(PageNodes* nodes, uint64_t page_number);
+void page_nodes_grow(PageNodes* nodes);
+void page_nodes_release(PageNodes* nodes, int node);
+long long* compute_next_use(TraceEntry* trace, int trace_size, int page_shift);
+void page_index_clear(PageIndex* index);
+TraceStream* open_trace_stream(const char* path, int lookahead, int window, int page_shift);
+TraceStream* open_memory_trace_stream(TraceEntry* entries, int count, int lookahead, int page_shift);
+int trace_stream_next(TraceStream* stream);
+void close_trace_stream(TraceStream* stream);
+TraceWriter* open_trace_writer(const char* path, unsigned int page_size);
+void trace_writer_append(TraceWriter* writer, TraceEntry* entry);
+int close_trace_writer(TraceWriter* writer);
 int fifo_replace(FIFOQueue* fifo);
 int lru_replace(LRUQueue* lru);
+void lru_touch(LRUQueue* lru, int frame);
 int clock_replace(ClockQueue* clock);
 int second_chance_replace(SecondChanceQueue* sc);
-int min_replace(TraceEntry* trace, int trace_size, int current_index, PageTable* pt, PhysicalMemory* pm);
-void simulate_virtual_memory(PageTable* pt, PhysicalMemory* pm, FIFOQueue* fifo, LRUQueue* lru, ClockQueue* clock, SecondChanceQueue* sc, int algorithm, TraceEntry* trace, int trace_size);
-void simulate_virtual_memory_step(PageTable* pt, PhysicalMemory* pm, FIFOQueue* fifo, LRUQueue* lru, ClockQueue* clock, SecondChanceQueue* sc, int algorithm, TraceEntry* trace, int step);
-void visualize_and_graph(TraceEntry* trace, int trace_size, PhysicalMemory* pm, PageTable* pt, PageTable* pt_graph, FIFOQueue* fifo, LRUQueue* lru, ClockQueue* clock, SecondChanceQueue* sc, int algorithm);
-void visualize(TraceEntry* trace, int trace_size);
-void list_processes_and_trace();
-void get_memory_access_trace(const char *pid);
-void add_trace_entry(char operation, unsigned long address);
+void second_chance_push(SecondChanceQueue* sc, int frame);
+int nru_replace(NruQueue* nru);
+int enhanced_clock_replace(EnhancedClockQueue* clock);
+int min_replace(MinQueue* min);
+void min_update(MinQueue* min, int frame, int step);
+Simulator* create_simulator(const ReplacementPolicy* policy, int frames, int page_shift);
+void free_simulator(Simulator* sim);
+void simulator_set_lookahead(Simulator* sim, long long* next_use);
+Checkpoints* create_checkpoints(const uint32_t* steps, int trace_size, int frames);
+int checkpoints_find(Checkpoints* checkpoints, int step, int* taken_at);
+void free_checkpoints(Checkpoints* checkpoints);
+void simulator_enable_translation(Simulator* sim, const TranslationConfig* config);
+TranslationModel* create_translation_model(const TranslationConfig* config, int page_shift);
+void free_translation_model(TranslationModel* model);
+void print_translation_statistics(TranslationModel* model);
+void simulator_enable_prefetch(Simulator* sim, const PrefetchConfig* config);
+Prefetcher* create_prefetcher(const PrefetchConfig* config, int frames);
+void free_prefetcher(Prefetcher* prefetcher);
+void print_prefetch_statistics(Prefetcher* prefetcher, PageTable* pt);
+void simulate_virtual_memory(Simulator* sim, TraceEntry* trace, int trace_size);
+int simulate_virtual_memory_step(Simulator* sim, TraceEntry* trace, int step, int* hit);
+void simulate_trace_stream(Simulator* sim, TraceStream* stream);
+double page_table_io_seconds(PageTable* pt);
+void print_statistics(PageTable* pt);
+EventLog* create_event_log(int level, const char* binary_path);
+void event_log_flush(EventLog* log);
+int close_event_log(EventLog* log);
+void run_comparison(TraceEntry* trace, int trace_size, int* page_shifts, int* frame_sizes, int config_count, int threads,
+                    const TranslationConfig* translation, const PrefetchConfig* prefetch);
+GlyphAtlas* create_glyph_atlas(SDL_Renderer* renderer, TTF_Font* font);
+void free_glyph_atlas(GlyphAtlas* atlas);
+int text_width(GlyphAtlas* atlas, const char* text);
+void draw_text(GlyphAtlas* atlas, SDL_Renderer* renderer, int x, int y, const char* text, SDL_Color color);
+void flush_text(GlyphAtlas* atlas, SDL_Renderer* renderer);
+Label create_label(SDL_Renderer* renderer, TTF_Font* font, const char* text);
+void draw_label(SDL_Renderer* renderer, Label* label, int x, int y);
+FrameView* create_frame_view(SDL_Renderer* renderer, int frames);
+void free_frame_view(FrameView* view);
+void frame_view_reset(FrameView* view);
+void frame_view_zoom(FrameView* view, double factor, int x, int y);
+void frame_view_pan(FrameView* view, int dx, int dy);
+void frame_view_apply(FrameView* view, const SimulationSnapshot* snapshot);
+void frame_view_draw(FrameView* view, SDL_Renderer* renderer, GlyphAtlas* atlas, const SimulationSnapshot* snapshot);
+SimulationWorker* create_simulation_worker(const uint32_t* steps, int trace_size, int frames, Checkpoints* checkpoints);
+void free_simulation_worker(SimulationWorker* worker);
+void simulation_worker_seek(SimulationWorker* worker, int step);
+SimulationSnapshot* simulation_worker_acquire(SimulationWorker* worker, int* fresh);
+void visualize_and_graph(TraceEntry* trace, int trace_size, Simulator* sim, const uint32_t* steps, Checkpoints* checkpoints);
+MissCurve* lru_miss_curve(TraceStream* stream, int max_frames);
+MissCurve* opt_miss_curve(TraceStream* stream, int max_frames);
+void write_miss_curve(MissCurve* curve, FILE* out);
+ResidentSetAllocator* create_resident_set_allocator(const AllocatorConfig* config, int frames);
+void free_resident_set_allocator(ResidentSetAllocator* allocator);
+void run_resident_set_allocator(TraceStream* stream, const AllocatorConfig* config, int frames, FILE* curve);
+void visualize(TraceEntry* trace, int trace_size, int page_shift);
+int list_processes_and_trace(const char* filter, int threads);
+int capture_trace(pid_t pid, const char* command, double seconds, long period);
+int sample_idle_pages(pid_t* pids, int count, int interval_ms, double seconds);
+void add_trace_entry(char operation, uint64_t address, uint16_t asid);
+int run_self_tests(void);
+int parse_size(const char* text, char** end, unsigned long long* size);
 
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <algorithm> <physical_address_bits>\n", argv[0]);
-        fprintf(stderr, "Algorithm: 0=FIFO, 1=LRU, 2=MIN, 3=SECOND CHANCE, 4=CLOCK\n");
-        fprintf(stderr, "Physical Address Bits: 20 or 24\n");
+    static struct option long_options[] = {
+        {"curve", required_argument, 0, 'c'},
+        {"trace", required_argument, 0, 't'},
+        {"min-window", required_argument, 0, 'w'},
+        {"save-trace", required_argument, 0, 's'},
+        {"compare", no_argument, 0, 'C'},
+        {"frames", required_argument, 0, 'f'},
+        {"threads", required_argument, 0, 'j'},
+        {"verbose", no_argument, 0, 'v'},
+        {"events", required_argument, 0, 'e'},
+        {"self-test", no_argument, 0, 'Z'},
+        {"memory", required_argument, 0, 'm'},
+        {"page-size", required_argument, 0, 'p'},
+        {"pid", required_argument, 0, 'P'},
+        {"exec", required_argument, 0, 'x'},
+        {"duration", required_argument, 0, 'd'},
+        {"sample-period", required_argument, 0, 'S'},
+        {"idle", required_argument, 0, 'I'},
+        {"interval", required_argument, 0, 'i'},
+        {"processes", required_argument, 0, 'T'},
+        {"tlb", required_argument, 0, 'L'},
+        {"levels", required_argument, 0, 'l'},
+        {"latency", required_argument, 0, 'F'},
+        {"prefetch", required_argument, 0, 'R'},
+        {"allocator", required_argument, 0, 'a'},
+        {0, 0, 0, 0}
+    };
+    const char* curve_path = NULL;
+    const char* trace_path = NULL;
+    const char* save_path = NULL;
+    const char* frames_list = NULL;
+    const char* events_path = NULL;
+    const char* memory_text = NULL;
+    const char* page_size_list = NULL;
+    const char* capture_command = NULL;
+    pid_t capture_pid = 0;
+    double capture_seconds = 0;
+    long sample_period = CAPTURE_SAMPLE_PERIOD;
+    const char* idle_list = NULL;
+    int idle_interval = IDLE_INTERVAL_MS;
+    const char* process_filter = NULL;
+    const char* tlb_spec = NULL;
+    int page_table_levels = 0;
+    const char* latency_text = NULL;
+    const char* prefetch_spec = NULL;
+    const char* allocator_spec = NULL;
+    int verbosity = LOG_QUIET;
+    int min_window = 0;
+    int compare = 0;
+    int threads = 0;
+    int self_test = 0;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "c:t:w:s:Cf:j:ve:m:p:P:x:d:S:I:i:T:L:l:F:R:a:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'c': curve_path = optarg; break;
+            case 'Z': self_test = 1; break;
+            case 't': trace_path = optarg; break;
+            case 'w': min_window = atoi(optarg); break;
+            case 's': save_path = optarg; break;
+            case 'C': compare = 1; break;
+            case 'f': frames_list = optarg; break;
+            case 'j': threads = atoi(optarg); break;
+            case 'v': verbosity++; break;
+            case 'e': events_path = optarg; break;
+            case 'm': memory_text = optarg; break;
+            case 'p': page_size_list = optarg; break;
+            case 'P': capture_pid = (pid_t)atoi(optarg); break;
+            case 'x': capture_command = optarg; break;
+            case 'd': capture_seconds = atof(optarg); break;
+            case 'S': sample_period = atol(optarg); break;
+            case 'I': idle_list = optarg; break;
+            case 'i': idle_interval = atoi(optarg); break;
+            case 'T': process_filter = optarg; break;
+            case 'L': tlb_spec = optarg; break;
+            case 'l': page_table_levels = atoi(optarg); break;
+            case 'F': latency_text = optarg; break;
+            case 'R': prefetch_spec = optarg; break;
+            case 'a': allocator_spec = optarg; break;
+            default: argc = 0; break;
+        }
+    }
+    if (self_test && argc > 0) return run_self_tests() == 0 ? 0 : 1;
+
+    // The physical address bits are optional once --memory or --frames
+    // gives the memory size.
+    int positional = argc - optind;
+    int required = (compare || allocator_spec) ? 0 : 1;
+    if (positional != required && positional != required + 1) {
+        fprintf(stderr, "Usage: %s [options] <algorithm> [physical_address_bits]\n", argv[0]);
+        fprintf(stderr, "       %s --compare [options] [physical_address_bits]\n", argv[0]);
+        fprintf(stderr, "       %s --allocator ws:TAU|pff:TAU [options] [physical_address_bits]\n", argv[0]);
+        fprintf(stderr, "       %s --self-test\n", argv[0]);
+        fprintf(stderr, "Algorithm: 0=FIFO, 1=LRU, 2=MIN, 3=SECOND CHANCE, 4=CLOCK, 5=ARC, 6=2Q, 7=LIRS, 8=CLOCK-PRO,\n");
+        fprintf(stderr, "           9=NRU, 10=ENHANCED SC\n");
+        fprintf(stderr, "Physical Address Bits: %d to %d, memory is 2^bits bytes\n", MIN_PAGE_SHIFT, MIN_PAGE_SHIFT + 31);
+        fprintf(stderr, "Options:\n");
+        fprintf(stderr, "  -c, --curve FILE   write the miss-ratio curve for 1..N frames as CSV (\"-\" for stdout); LRU and MIN only (MIN holds\n");
+        fprintf(stderr, "                     the whole trace's reuses in memory, ~50 bytes per reference); with --allocator,\n");
+        fprintf(stderr, "                     the resident-set size over time\n");
+        fprintf(stderr, "  -t, --trace FILE   stream a binary trace or a text trace (\"l|s <hex address>\" per line, \"-\" for stdin) instead of tracing live\n");
+        fprintf(stderr, "  -s, --save-trace FILE  also write the trace in the compact binary format\n");
+        fprintf(stderr, "  -w, --min-window N give MIN an N-entry lookahead window instead of an exact two-pass replay\n");
+        fprintf(stderr, "  -C, --compare      run every algorithm concurrently and print one comparison table\n");
+        fprintf(stderr, "  -m, --memory SIZE  physical memory size, e.g. 512M or 32G, instead of physical_address_bits\n");
+        fprintf(stderr, "  -p, --page-size SIZE  page size: 4K (default), 16K, 64K, 2M or any power of two up to 1G;\n");
+        fprintf(stderr, "                     a comma-separated list with --compare\n");
+        fprintf(stderr, "  -f, --frames LIST  frame count, or comma-separated frame counts with --compare (default: memory / page size)\n");
+        fprintf(stderr, "  -j, --threads N    compare-mode worker threads (default: number of CPUs)\n");
+        fprintf(stderr, "  -v, --verbose      print page faults and evictions; repeat (-vv) to print every access\n");
+        fprintf(stderr, "  -e, --events FILE  record every hit, miss and eviction to a binary event file\n");
+        fprintf(stderr, "  -P, --pid PID      capture the real page references of a running process with perf_event\n");
+        fprintf(stderr, "  -x, --exec COMMAND run COMMAND through /bin/sh and capture its page references\n");
+        fprintf(stderr, "  -d, --duration SEC stop capturing after SEC seconds (default: until the process exits or Ctrl-C)\n");
+        fprintf(stderr, "  -S, --sample-period N  record one in N loads and stores (default: %d)\n", CAPTURE_SAMPLE_PERIOD);
+        fprintf(stderr, "  -I, --idle PIDS    sample the working set of running processes with idle page tracking\n");
+        fprintf(stderr, "  -i, --interval MS  idle page sampling interval (default: %d)\n", IDLE_INTERVAL_MS);
+        fprintf(stderr, "  -T, --processes LIST  trace only these PIDs or command names from /proc (default: all)\n");
+        fprintf(stderr, "  -L, --tlb SPEC     model address translation with an L1/L2 TLB: 'default' (%d/%d,%d/%d)\n",
+                TLB_L1_ENTRIES, TLB_L1_WAYS, TLB_L2_ENTRIES, TLB_L2_WAYS);
+        fprintf(stderr, "                     or ENTRIES/WAYS,ENTRIES/WAYS\n");
+        fprintf(stderr, "  -l, --levels N     page-table levels walked on a TLB miss: 4 (default) or 5\n");
+        fprintf(stderr, "  -F, --latency R,W,WB  microseconds per read fault, write fault and dirty write-back\n");
+        fprintf(stderr, "                     for the I/O time estimate (default: %g,%g,%g)\n",
+                fault_latency.read, fault_latency.write, fault_latency.write_back);
+        fprintf(stderr, "  -R, --prefetch KIND[:N]  on each fault also load up to N pages (default %d) picked by\n", PREFETCH_DEGREE);
+        fprintf(stderr, "                     sequential readahead, stride detection or a Markov table: sequential|stride|markov\n");
+        fprintf(stderr, "  -a, --allocator ws:TAU|pff:TAU  let the resident set grow and shrink: the working set of the\n");
+        fprintf(stderr, "                     last TAU references, or page-fault frequency with TAU references between\n");
+        fprintf(stderr, "                     faults as the threshold; reports thrashing when memory is given\n");
+        fprintf(stderr, "      --self-test    check the policies against naive reference implementations on seeded\n");
+        fprintf(stderr, "                     random traces and exit non-zero on any difference\n");
         return 1;
     }
 
-    int algorithm = atoi(argv[1]);
-    if (algorithm < 0 || algorithm > 4) {
+    int algorithm = required ? atoi(argv[optind]) : 0;
+    if (algorithm < 0 || algorithm >= NUM_ALGORITHMS) {
         fprintf(stderr, "Invalid algorithm choice\n");
         return 1;
     }
+    if (capture_pid < 0 || (trace_path != NULL) + (capture_pid != 0) + (capture_command != NULL) + (idle_list != NULL)
+            + (process_filter != NULL) > 1) {
+        fprintf(stderr, "Give one trace source: --trace, --pid, --exec, --idle or --processes\n");
+        return 1;
+    }
+    int idle_count = 0;
+    pid_t* idle_pids = NULL;
+    if (idle_list) {
+        idle_pids = (pid_t*)malloc(sizeof(pid_t) * (strlen(idle_list) / 2 + 1));
+        for (char* p = (char*)idle_list; *p; ) {
+            char* end;
+            long pid = strtol(p, &end, 10);
+            if (end == p || pid <= 0 || (*end != ',' && *end != '\0')) {
+                fprintf(stderr, "Invalid PID list: %s\n", idle_list);
+                return 1;
+            }
+            idle_pids[idle_count++] = (pid_t)pid;
+            p = (*end == ',') ? end + 1 : end;
+        }
+    }
+    if (idle_interval <= 0) {
+        fprintf(stderr, "Invalid sampling interval: must be positive\n");
+        return 1;
+    }
+    if (sample_period <= 0) {
+        fprintf(stderr, "Invalid sample period: must be positive\n");
+        return 1;
+    }
+    if (latency_text) {
+        char tail;
+        if (sscanf(latency_text, "%lf,%lf,%lf%c", &fault_latency.read, &fault_latency.write,
+                   &fault_latency.write_back, &tail) != 3
+                || fault_latency.read < 0 || fault_latency.write < 0 || fault_latency.write_back < 0) {
+            fprintf(stderr, "Invalid latencies: %s (READ,WRITE,WRITEBACK in microseconds)\n", latency_text);
+            return 1;
+        }
+    }
+
+    TranslationConfig translation = {TLB_L1_ENTRIES, TLB_L1_WAYS, TLB_L2_ENTRIES, TLB_L2_WAYS, PAGE_TABLE_LEVELS};
+    if (tlb_spec && strcmp(tlb_spec, "default") != 0) {
+        char tail;
+        if (sscanf(tlb_spec, "%d/%d,%d/%d%c", &translation.l1_entries, &translation.l1_ways,
+                   &translation.l2_entries, &translation.l2_ways, &tail) != 4
+                || translation.l1_ways <= 0 || translation.l1_entries < translation.l1_ways
+                || translation.l1_entries % translation.l1_ways != 0
+                || translation.l2_ways <= 0 || translation.l2_entries < translation.l2_ways
+                || translation.l2_entries % translation.l2_ways != 0) {
+            fprintf(stderr, "Invalid TLB: %s (ENTRIES/WAYS,ENTRIES/WAYS with entries a multiple of ways)\n", tlb_spec);
+            return 1;
+        }
+    }
+    if (page_table_levels) {
+        if (page_table_levels != 4 && page_table_levels != 5) {
+            fprintf(stderr, "Invalid page-table levels: must be 4 or 5\n");
+            return 1;
+        }
+        translation.levels = page_table_levels;
+    }
+    PrefetchConfig prefetch = {PREFETCH_NONE, PREFETCH_DEGREE};
+    if (prefetch_spec) {
+        const char* kinds[] = {"sequential", "stride", "markov"};
+        size_t length = strcspn(prefetch_spec, ":");
+        for (int k = 0; k < 3; k++) {
+            if (length == strlen(kinds[k]) && strncmp(prefetch_spec, kinds[k], length) == 0) prefetch.kind = PREFETCH_SEQUENTIAL + k;
+        }
+        char* end = (char*)prefetch_spec + length;
+        if (*end == ':') prefetch.degree = (int)strtol(end + 1, &end, 10);
+        if (prefetch.kind == PREFETCH_NONE || *end != '\0' || prefetch.degree <= 0 || prefetch.degree > PREFETCH_MAX_DEGREE) {
+            fprintf(stderr, "Invalid prefetcher: %s (sequential, stride or markov, optionally :N with N up to %d)\n",
+                    prefetch_spec, PREFETCH_MAX_DEGREE);
+            return 1;
+        }
+        // MIN's hooks key a frame by the next use of the reference at hand,
+        // which says nothing about a page loaded alongside it.
+        if (!compare && policies[algorithm]->set_lookahead) {
+            fprintf(stderr, "Prefetching is not supported with MIN\n");
+            return 1;
+        }
+    }
+    const PrefetchConfig* prefetch_config = prefetch_spec ? &prefetch : NULL;
+    AllocatorConfig allocator = {ALLOCATOR_WORKING_SET, 0};
+    if (allocator_spec) {
+        char* end;
+        if (strncmp(allocator_spec, "ws:", 3) == 0) {
+            allocator.tau = strtoll(allocator_spec + 3, &end, 10);
+        } else if (strncmp(allocator_spec, "pff:", 4) == 0) {
+            allocator.kind = ALLOCATOR_PFF;
+            allocator.tau = strtoll(allocator_spec + 4, &end, 10);
+        } else {
+            end = (char*)allocator_spec;
+        }
+        if (allocator.tau <= 0 || *end != '\0') {
+            fprintf(stderr, "Invalid allocator: %s (ws:TAU or pff:TAU, TAU a positive number of references)\n", allocator_spec);
+            return 1;
+        }
+        if (compare) {
+            fprintf(stderr, "--allocator and --compare cannot be combined\n");
+            return 1;
+        }
+    }
+    // --levels alone turns the model on with the default TLB.
+    const TranslationConfig* translation_config = (tlb_spec || page_table_levels) ? &translation : NULL;
+    if (curve_path && !allocator_spec && algorithm != 1 && algorithm != 2) {
+        fprintf(stderr, "Miss-ratio curves need a stack algorithm (1=LRU or 2=MIN)\n");
+        return 1;
+    }
 
-    int physical_address_bits = atoi(argv[2]);
-    if (physical_address_bits != 20 && physical_address_bits != 24) {
-        fprintf(stderr, "Invalid physical address bits (must be 20 or 24)\n");
+    unsigned long long memory_size = 0;
+    if (positional == required + 1) {
+        int physical_address_bits = atoi(argv[argc - 1]);
+        if (physical_address_bits < MIN_PAGE_SHIFT || physical_address_bits > MIN_PAGE_SHIFT + 31) {
+            fprintf(stderr, "Invalid physical address bits (must be %d to %d)\n", MIN_PAGE_SHIFT, MIN_PAGE_SHIFT + 31);
+            return 1;
+        }
+        memory_size = 1ULL << physical_address_bits;
+    }
+    if (memory_text) {
+        char* end;
+        if (parse_size(memory_text, &end, &memory_size) != 0 || *end != '\0') {
+            fprintf(stderr, "Invalid memory size: %s\n", memory_text);
+            return 1;
+        }
+    }
+    if (memory_size == 0 && !frames_list && !allocator_spec) {
+        fprintf(stderr, "Give the memory size as physical_address_bits, --memory or --frames\n");
         return 1;
     }
 
-    int physical_memory_size = (physical_address_bits == 20) ? PHYSICAL_MEMORY_SIZE_20BIT : PHYSICAL_MEMORY_SIZE_24BIT;
-    int num_frames = physical_memory_size / PAGE_SIZE;
+    int page_size_count = 0;
+    int* page_shifts = (int*)malloc(sizeof(int) * (page_size_list ? strlen(page_size_list) / 2 + 1 : 1));
+    if (page_size_list) {
+        for (char* p = (char*)page_size_list; *p; ) {
+            char* end;
+            unsigned long long page_size;
+            if (parse_size(p, &end, &page_size) != 0 || (page_size & (page_size - 1)) != 0
+                    || page_size < (1ULL << MIN_PAGE_SHIFT) || page_size > (1ULL << MAX_PAGE_SHIFT)
+                    || (*end != ',' && *end != '\0')) {
+                fprintf(stderr, "Invalid page size list: %s (powers of two from 4K to 1G)\n", page_size_list);
+                return 1;
+            }
+            page_shifts[page_size_count++] = __builtin_ctzll(page_size);
+            p = (*end == ',') ? end + 1 : end;
+        }
+    } else {
+        page_shifts[page_size_count++] = MIN_PAGE_SHIFT;
+    }
+
+    TraceWriter* writer = NULL;
+    if (save_path) {
+        writer = open_trace_writer(save_path, PAGE_SIZE);
+        if (!writer) {
+            perror("Failed to create trace file");
+            return 1;
+        }
+    }
 
-    list_processes_and_trace();
-    printf("Live trace collected. Trace size: %d\n", trace_size);
+    int frame_list_count = 0;
+    int* frame_list = (int*)malloc(sizeof(int) * (frames_list ? strlen(frames_list) / 2 + 1 : 1));
+    if (frames_list) {
+        for (char* p = (char*)frames_list; *p; ) {
+            char* end;
+            long frames = strtol(p, &end, 10);
+            if (end == p || frames <= 0 || frames > MAX_FRAMES) {
+                fprintf(stderr, "Invalid frame count list: %s\n", frames_list);
+                return 1;
+            }
+            frame_list[frame_list_count++] = (int)frames;
+            p = (*end == ',') ? end + 1 : end;
+        }
+    }
 
-    if (trace_size == 0) {
-        fprintf(stderr, "Error: No memory access traces collected. Try running with higher privileges.\n");
+    // One configuration per page size and frame count. Without --frames
+    // the memory size is fixed and the frame count follows the page size.
+    int config_count = 0;
+    int config_capacity = page_size_count * (frames_list ? frame_list_count : 1);
+    int* config_shifts = (int*)malloc(sizeof(int) * config_capacity);
+    int* frame_sizes = (int*)malloc(sizeof(int) * config_capacity);
+    for (int s = 0; s < page_size_count; s++) {
+        if (frames_list) {
+            for (int f = 0; f < frame_list_count; f++) {
+                config_shifts[config_count] = page_shifts[s];
+                frame_sizes[config_count++] = frame_list[f];
+            }
+            continue;
+        }
+        // Only the allocator runs without a memory size; it then has no
+        // memory to thrash in.
+        unsigned long long frames = memory_size >> page_shifts[s];
+        if ((frames == 0 && memory_size != 0) || frames > MAX_FRAMES) {
+            fprintf(stderr, "Memory of %llu bytes does not divide into 1 to %d pages of %lluK\n",
+                    memory_size, MAX_FRAMES, (1ULL << page_shifts[s]) >> 10);
+            return 1;
+        }
+        config_shifts[config_count] = page_shifts[s];
+        frame_sizes[config_count++] = (int)frames;
+    }
+    free(page_shifts);
+    free(frame_list);
+    if (!compare && config_count > 1) {
+        fprintf(stderr, "Several page sizes or frame counts need --compare\n");
         return 1;
     }
+    int page_shift = config_shifts[0];
+    int num_frames = frame_sizes[0];
+    if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0) threads = 1;
 
-    PageTable* pt_graph = create_page_table(num_frames);
-    PhysicalMemory* pm_graph = create_physical_memory(num_frames);
-    FIFOQueue* fifo_graph = create_fifo_queue(num_frames);
-    LRUQueue* lru_graph = create_lru_queue(num_frames);
-    ClockQueue* clock_graph = create_clock_queue(num_frames);
-    SecondChanceQueue* sc_graph = create_second_chance_queue(num_frames);
-
-    simulate_virtual_memory(pt_graph, pm_graph, fifo_graph, lru_graph, clock_graph, sc_graph, algorithm, trace, trace_size);
-
-    printf("Debug: Hits = %d, Misses = %d\n", pt_graph->hits, pt_graph->misses);
-    printf("Total references: %d\n", pt_graph->hits + pt_graph->misses);
-    printf("Page faults: %d\n", pt_graph->page_faults);
-    printf("Hit ratio: %.2f%%\n", (float)pt_graph->hits / (pt_graph->hits + pt_graph->misses) * 100);
-    printf("Miss ratio: %.2f%%\n", (float)pt_graph->misses / (pt_graph->hits + pt_graph->misses) * 100);
-
-    free_physical_memory(pm_graph);
-    free_fifo_queue(fifo_graph);
-    free_lru_queue(lru_graph);
-    free_clock_queue(clock_graph);
-    free_second_chance_queue(sc_graph);
-
-    PageTable* pt = create_page_table(num_frames);
-    PhysicalMemory* pm = create_physical_memory(num_frames);
-    FIFOQueue* fifo = create_fifo_queue(num_frames);
-    LRUQueue* lru = create_lru_queue(num_frames);
-    ClockQueue* clock = create_clock_queue(num_frames);
-    SecondChanceQueue* sc = create_second_chance_queue(num_frames);
-
-    visualize_and_graph(trace, trace_size, pm, pt, pt_graph, fifo, lru, clock, sc, algorithm);
-
-    free_page_table(pt);
-    free_physical_memory(pm);
-    free_fifo_queue(fifo);
-    free_lru_queue(lru);
-    free_clock_queue(clock);
-    free_second_chance_queue(sc);
-    free_page_table(pt_graph);
+    TraceStream* stream = NULL;
+    if (trace_path) {
+        int lookahead = LOOKAHEAD_NONE;
+        if (algorithm == 2 && !compare && !curve_path) lookahead = (min_window > 0) ? LOOKAHEAD_WINDOW : LOOKAHEAD_TWO_PASS;
+        stream = open_trace_stream(trace_path, lookahead, min_window, page_shift);
+        if (!stream) {
+            perror("Failed to open trace file");
+            return 1;
+        }
+        stream->tee = writer;
+    } else {
+        if (capture_pid || capture_command) {
+            if (capture_trace(capture_pid, capture_command, capture_seconds, sample_period) != 0) return 1;
+        } else if (idle_pids) {
+            int status = sample_idle_pages(idle_pids, idle_count, idle_interval, capture_seconds);
+            free(idle_pids);
+            if (status != 0) return 1;
+        } else {
+            list_processes_and_trace(process_filter, threads);
+        }
+        printf("Live trace collected. Trace size: %d", trace_size);
+        if (trace_process_count > 1) printf(" from %d processes", trace_process_count);
+        printf("\n");
 
-    return 0;
-}
+        if (trace_size == 0) {
+            fprintf(stderr, "Error: No memory access traces collected. Try running with higher privileges.\n");
+            return 1;
+        }
+        if (writer) {
+            for (int i = 0; i < trace_size; i++) trace_writer_append(writer, &trace[i]);
+            if (close_trace_writer(writer) != 0) perror("Failed to write trace file");
+            writer = NULL;
+        }
+    }
 
-void add_trace_entry(char operation, unsigned long address) {
-    if (trace_size < MAX_TRACE_ENTRIES) {
-        trace[trace_size].operation = operation;
-        trace[trace_size].address = address / PAGE_SIZE;
-        trace_size++;
+    if (compare) {
+        // Compare mode needs the whole trace at hand for every worker, so a
+        // streamed trace is loaded into the shared in-memory buffer first.
+        if (stream) {
+            while (trace_stream_next(stream) > 0) {
+                for (int i = 0; i < stream->chunk_size; i++) {
+                    add_trace_entry(stream->chunk[i].operation, stream->chunk[i].address, stream->chunk[i].asid);
+                }
+            }
+            close_trace_stream(stream);
+            if (writer && close_trace_writer(writer) != 0) perror("Failed to write trace file");
+            printf("Trace loaded. Trace size: %d\n", trace_size);
+        }
+        run_comparison(trace, trace_size, config_shifts, frame_sizes, config_count, threads, translation_config,
+                       prefetch_config);
+        free(config_shifts);
+        free(frame_sizes);
+        return 0;
     }
-}
+    free(config_shifts);
+    free(frame_sizes);
 
-void list_processes_and_trace() {
-    struct dirent *entry;
-    DIR *dp = opendir("/proc");
-    if (dp == NULL) {
-        perror("Error: Unable to open /proc. Try running as root.");
-        exit(1);
+    if (allocator_spec) {
+        FILE* out = NULL;
+        if (curve_path) {
+            out = strcmp(curve_path, "-") == 0 ? stdout : fopen(curve_path, "w");
+            if (!out) {
+                perror("Failed to open curve file");
+                return 1;
+            }
+        }
+        if (!stream) stream = open_memory_trace_stream(trace, trace_size, LOOKAHEAD_NONE, page_shift);
+        run_resident_set_allocator(stream, &allocator, num_frames, out);
+        if (out && out != stdout) fclose(out);
+        close_trace_stream(stream);
+        if (writer && close_trace_writer(writer) != 0) perror("Failed to write trace file");
+        return 0;
     }
 
-   //  entry = readdir(dp);
-//      printf("%d",entry->d_name[0]);
-  //      if (isdigit(entry->d_name[0])) {
-            get_memory_access_trace("640");
-    //    }
+    if (curve_path) {
+        FILE* out = strcmp(curve_path, "-") == 0 ? stdout : fopen(curve_path, "w");
+        if (!out) {
+            perror("Failed to open curve file");
+            return 1;
+        }
+        if (!stream) stream = open_memory_trace_stream(trace, trace_size, LOOKAHEAD_NONE, page_shift);
+        MissCurve* curve = (algorithm == 1) ? lru_miss_curve(stream, num_frames)
+                                            : opt_miss_curve(stream, num_frames);
+        if (!curve) {
+            fprintf(stderr, "Trace too long for the MIN curve\n");
+            if (out != stdout) fclose(out);
+            close_trace_stream(stream);
+            return 1;
+        }
+        write_miss_curve(curve, out);
+        if (out != stdout) fclose(out);
+        free_miss_curve(curve);
+        close_trace_stream(stream);
+        if (writer && close_trace_writer(writer) != 0) perror("Failed to write trace file");
+        return 0;
+    }
 
-    closedir(dp);
-}
+    if (verbosity > LOG_QUIET || events_path) {
+        event_log = create_event_log(verbosity, events_path);
+        if (!event_log) {
+            perror("Failed to create event file");
+            return 1;
+        }
+    }
 
-void get_memory_access_trace(const char *pid) {
-    char path[256];
-    snprintf(path, sizeof(path), "/proc/640/maps", pid);
-        strcpy(path,"/proc/641/maps");
-    srand(time(NULL));
-    int randnum;
-    FILE *fp = fopen(path, "r");
-    if (!fp) return;
+    if (stream) {
+        // File traces can be far larger than memory, so they are replayed
+        // chunk by chunk without the visualizer.
+        Simulator* sim = create_simulator(policies[algorithm], num_frames, page_shift);
+        if (translation_config) simulator_enable_translation(sim, translation_config);
+        if (prefetch_config) simulator_enable_prefetch(sim, prefetch_config);
 
-    char line[256];
-    int unique_pages = 0;
-    while (fgets(line, sizeof(line), fp) != NULL) {
-        unsigned long start, end;
-        char perms[5];
+        simulate_trace_stream(sim, stream);
+        if (event_log && close_event_log(event_log) != 0) perror("Failed to write event file");
+        event_log = NULL;
+        print_statistics(sim->pt);
+        if (sim->translation) print_translation_statistics(sim->translation);
+        if (sim->prefetcher) print_prefetch_statistics(sim->prefetcher, sim->pt);
 
-        if (sscanf(line, "%lx-%lx %4s", &start, &end, perms) == 3) {
-           // if (strchr(perms, 'r')) {
-                for (unsigned long addr = start; addr < end; addr += PAGE_SIZE) {
-                    if (unique_pages < 100) {
-                        add_trace_entry('l', addr);
-                        randnum=(rand()%3)+2;
-                        for (int i = 0; i < randnum; i++) {
-                            add_trace_entry('l', addr);
-                        }
-                        unique_pages++;
-                    }
-                }
-            //}
-           // if (strchr(perms, 'w')) {
-                add_trace_entry('s', start);
-                randnum=(rand()%3)+2;
-                for (int i = 0; i < randnum; i++) {
-                    add_trace_entry('s', start);
-             //   }
-                unique_pages++;
-            }
-        }
+        free_simulator(sim);
+        close_trace_stream(stream);
+        if (writer && close_trace_writer(writer) != 0) perror("Failed to write trace file");
+        return 0;
     }
-    fclose(fp);
+
+    // The visualizer replays this one pass from its step log instead of
+    // simulating the trace again.
+    long long* next_use = policies[algorithm]->set_lookahead ? compute_next_use(trace, trace_size, page_shift) : NULL;
+    uint32_t* steps = (uint32_t*)malloc(sizeof(uint32_t) * trace_size);
+
+    Simulator* sim = create_simulator(policies[algorithm], num_frames, page_shift);
+    simulator_set_lookahead(sim, next_use);
+    sim->steps = steps;
+    if (trace_process_count > 1) page_table_track_asids(sim->pt, trace_process_count);
+    if (translation_config) simulator_enable_translation(sim, translation_config);
+    if (prefetch_config) simulator_enable_prefetch(sim, prefetch_config);
+    simulate_virtual_memory(sim, trace, trace_size);
+    // Checkpoints let the animation seek without replaying from the start.
+    Checkpoints* checkpoints = create_checkpoints(steps, trace_size, num_frames);
+    if (event_log && close_event_log(event_log) != 0) perror("Failed to write event file");
+    event_log = NULL;
+
+    print_statistics(sim->pt);
+    if (sim->translation) print_translation_statistics(sim->translation);
+    if (sim->prefetcher) print_prefetch_statistics(sim->prefetcher, sim->pt);
+
+    visualize_and_graph(trace, trace_size, sim, steps, checkpoints);
+
+    free_simulator(sim);
+    free_checkpoints(checkpoints);
+    free(steps);
+    free(next_use);
+
+    return 0;
 }
 
-PageTable* create_page_table(int size) {
-    PageTable* pt = (PageTable*)malloc(sizeof(PageTable));
-    pt->entries = (PageTableEntry*)calloc(size, sizeof(PageTableEntry));
-    pt->size = size;
-    pt->page_faults = 0;
-    pt->hits = 0;
-    pt->misses = 0;
-    for (int i = 0; i < size; i++) {
-        pt->entries[i].page_number = -1;
-        pt->entries[i].frame_number = -1;
-        pt->entries[i].referenced = 0;
-        pt->entries[i].valid = 0;
+void add_trace_entry(char operation, uint64_t address, uint16_t asid) {
+    if (trace_size == trace_capacity) {
+        int capacity = trace_capacity ? trace_capacity * 2 : 4096;
+        TraceEntry* grown = (TraceEntry*)realloc(trace, (size_t)capacity * sizeof(TraceEntry));
+        if (!grown) {
+            fprintf(stderr, "Error: Out of memory after %d trace entries\n", trace_size);
+            exit(1);
+        }
+        trace = grown;
+        trace_capacity = capacity;
     }
-    return pt;
+    trace[trace_size].operation = operation;
+    trace[trace_size].asid = asid;
+    trace[trace_size].address = address;
+    trace_size++;
 }
 
-PhysicalMemory* create_physical_memory(int size) {
-    PhysicalMemory* pm = (PhysicalMemory*)malloc(sizeof(PhysicalMemory));
-    pm->frames = (int*)calloc(size, sizeof(int));
-    for (int i = 0; i < size; i++) pm->frames[i] = -1;
-    pm->size = size;
-    pm->next_frame = 0;
-    return pm;
+// Parse a byte count with an optional binary suffix: 4096, 64K, 2M, 16G.
+// *end is left after the number so lists can be parsed.
+int parse_size(const char* text, char** end, unsigned long long* size) {
+    unsigned long long value = strtoull(text, end, 10);
+    if (*end == text || value == 0) return -1;
+    int shift = 0;
+    switch (toupper((unsigned char)**end)) {
+        case 'K': shift = 10; break;
+        case 'M': shift = 20; break;
+        case 'G': shift = 30; break;
+        case 'T': shift = 40; break;
+    }
+    if (shift) (*end)++;
+    if (value > (ULLONG_MAX >> shift)) return -1;
+    *size = value << shift;
+    return 0;
 }
 
-FIFOQueue* create_fifo_queue(int size) {
-    FIFOQueue* fifo = (FIFOQueue*)malloc(sizeof(FIFOQueue));
-    fifo->pages = (int*)calloc(size, sizeof(int));
-    fifo->frames = (int*)calloc(size, sizeof(int));
-    for (int i = 0; i < size; i++) {
-        fifo->pages[i] = -1;
-        fifo->frames[i] = -1;
+// Text traces hold one reference per line: an operation letter and a hex
+// byte address, e.g. "l 7ffd5a3c1000" or Valgrind lackey's " S 04222cac,4".
+// Instruction fetches count as loads and modifies as stores; anything else
+// (comments, headers) is skipped.
+static int read_text_trace(FILE* fp, TraceEntry* entries, int max_entries) {
+    char line[256];
+    int count = 0;
+    while (count < max_entries && fgets(line, sizeof(line), fp) != NULL) {
+        char* p = line;
+        while (isspace((unsigned char)*p)) p++;
+        char op = tolower((unsigned char)*p);
+        if (op != 'l' && op != 's' && op != 'm' && op != 'i') continue;
+        p++;
+        if (!isspace((unsigned char)*p)) continue;
+        char* end;
+        uint64_t address = strtoull(p, &end, 16);
+        if (end == p) continue;
+        entries[count].operation = (op == 's' || op == 'm') ? 's' : 'l';
+        entries[count].asid = 0;
+        entries[count].address = address;
+        count++;
     }
-    fifo->size = size;
-    fifo->next_index = 0;
-    return fifo;
+    return count;
 }
 
-LRUQueue* create_lru_queue(int size) {
-    LRUQueue* lru = (LRUQueue*)malloc(sizeof(LRUQueue));
-    lru->pages = (int*)calloc(size, sizeof(int));
-    lru->frames = (int*)calloc(size, sizeof(int));
-    lru->ages = (int*)calloc(size, sizeof(int));
-    for (int i = 0; i < size; i++) {
-        lru->pages[i] = -1;
-        lru->frames[i] = -1;
-        lru->ages[i] = 0;
-    }
-    lru->size = size;
-    return lru;
+static void put_le32(unsigned char* p, uint32_t value) {
+    for (int i = 0; i < 4; i++) p[i] = (unsigned char)(value >> (8 * i));
 }
 
-ClockQueue* create_clock_queue(int size) {
-    ClockQueue* clock = (ClockQueue*)malloc(sizeof(ClockQueue));
-    clock->pages = (int*)calloc(size, sizeof(int));
-    clock->frames = (int*)calloc(size, sizeof(int));
+static void put_le64(unsigned char* p, uint64_t value) {
+    for (int i = 0; i < 8; i++) p[i] = (unsigned char)(value >> (8 * i));
+}
+
+static uint32_t get_le32(const unsigned char* p) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) value |= (uint32_t)p[i] << (8 * i);
+    return value;
+}
+
+static uint64_t get_le64(const unsigned char* p) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) value |= (uint64_t)p[i] << (8 * i);
+    return value;
+}
+
+static void write_trace_header(TraceWriter* writer) {
+    unsigned char header[TRACE_FILE_HEADER_SIZE] = {0};
+    memcpy(header, TRACE_FILE_MAGIC, sizeof(TRACE_FILE_MAGIC));
+    put_le32(header + 8, TRACE_FILE_VERSION);
+    put_le32(header + 12, writer->page_size);
+    put_le64(header + 16, writer->count);
+    put_le32(header + 24, TRACE_OP_LOW_BIT);
+    put_le32(header + 28, TRACE_FILE_HEADER_SIZE);
+    fwrite(header, 1, sizeof(header), writer->file);
+}
+
+TraceWriter* open_trace_writer(const char* path, unsigned int page_size) {
+    FILE* fp = fopen(path, "wb");
+    if (!fp) return NULL;
+    TraceWriter* writer = (TraceWriter*)calloc(1, sizeof(TraceWriter));
+    writer->file = fp;
+    writer->page_size = page_size;
+    setvbuf(fp, NULL, _IOFBF, 1 << 20);
+    // The entry count is patched in when the writer is closed.
+    write_trace_header(writer);
+    return writer;
+}
+
+void trace_writer_append(TraceWriter* writer, TraceEntry* entry) {
+    uint64_t page = trace_page(entry, __builtin_ctz(writer->page_size));
+    int64_t delta = (int64_t)(page - writer->last_page);
+    uint64_t zigzag = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+    // The record is the 65-bit number (zigzag << 1) | is_store. Deltas of
+    // 2^62 pages or more set the top bit, which only the tenth byte carries.
+    uint64_t value = zigzag << 1 | (entry->operation == 's');
+    uint64_t top = zigzag >> 63;
+    unsigned char bytes[TRACE_RECORD_MAX_BYTES];
+    int length = 0;
+    do {
+        bytes[length] = value & 0x7f;
+        value = value >> 7 | top << 57;
+        top = 0;
+        if (value) bytes[length] |= 0x80;
+        length++;
+    } while (value);
+    fwrite(bytes, 1, length, writer->file);
+    writer->last_page = page;
+    writer->count++;
+}
+
+int close_trace_writer(TraceWriter* writer) {
+    int status = 0;
+    if (fseek(writer->file, 0, SEEK_SET) == 0) {
+        write_trace_header(writer);
+    } else {
+        status = -1;
+    }
+    if (fclose(writer->file) != 0) status = -1;
+    free(writer);
+    return status;
+}
+
+// Map a binary trace read-only; returns 0 if the file is not one and -1,
+// with errno set, if its header is unusable.
+static int map_binary_trace(TraceStream* stream, const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < TRACE_FILE_HEADER_SIZE) {
+        close(fd);
+        return 0;
+    }
+    unsigned char* data = (unsigned char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return 0;
+    if (memcmp(data, TRACE_FILE_MAGIC, sizeof(TRACE_FILE_MAGIC)) != 0
+            || get_le32(data + 8) != TRACE_FILE_VERSION
+            || get_le32(data + 24) != TRACE_OP_LOW_BIT) {
+        munmap(data, st.st_size);
+        return 0;
+    }
+    uint32_t page_size = get_le32(data + 12);
+    uint32_t records_at = get_le32(data + 28);
+    if (page_size == 0 || (page_size & (page_size - 1)) != 0) {
+        fprintf(stderr, "%s: page size %u is not a power of two\n", path, page_size);
+        munmap(data, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+    if (records_at < TRACE_FILE_HEADER_SIZE || records_at > (uint64_t)st.st_size) {
+        fprintf(stderr, "%s: records start at byte %u, not between the header and the end of the file\n", path, records_at);
+        munmap(data, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    stream->mapped = data;
+    stream->mapped_size = st.st_size;
+    stream->mapped_page_size = page_size;
+    stream->mapped_remaining = get_le64(data + 16);
+    stream->cursor = records_at;
+    return 1;
+}
+
+// Reads one record at *cursor. Returns -1, leaving the cursor alone, if it
+// runs past the end of the mapping or past 65 bits.
+static int decode_trace_record(const unsigned char* data, size_t size, size_t* cursor, uint64_t* zigzag, int* store) {
+    size_t at = *cursor;
+    uint64_t value = 0;
+    uint64_t top = 0;
+    for (int length = 0;; length++) {
+        if (at == size || length == TRACE_RECORD_MAX_BYTES) return -1;
+        unsigned char byte = data[at++];
+        if (length == TRACE_RECORD_MAX_BYTES - 1) {
+            if (byte > 3) return -1;
+            value |= (uint64_t)(byte & 1) << 63;
+            top = byte >> 1;
+            break;
+        }
+        value |= (uint64_t)(byte & 0x7f) << (7 * length);
+        if (!(byte & 0x80)) break;
+    }
+    *zigzag = value >> 1 | top << 63;
+    *store = value & 1;
+    *cursor = at;
+    return 0;
+}
+
+// Decode varint records straight out of the mapping, turning the recorded
+// page numbers back into byte addresses. A malformed record ends the trace.
+static int decode_binary_trace(TraceStream* stream, TraceEntry* entries, int max_entries) {
+    int count = 0;
+    const unsigned char* data = stream->mapped;
+    size_t cursor = stream->cursor;
+    while (count < max_entries && stream->mapped_remaining > 0 && cursor < stream->mapped_size) {
+        uint64_t zigzag;
+        int store;
+        if (decode_trace_record(data, stream->mapped_size, &cursor, &zigzag, &store) != 0) {
+            if (!stream->quiet) fprintf(stderr, "Malformed record at byte %zu of the binary trace; stopping there\n", cursor);
+            stream->mapped_remaining = 0;
+            break;
+        }
+        int64_t delta = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+        stream->last_page += (uint64_t)delta;
+        entries[count].operation = store ? 's' : 'l';
+        entries[count].asid = (uint16_t)(stream->last_page >> ASID_SHIFT);
+        entries[count].address = (stream->last_page & PAGE_KEY_MASK) * (uint64_t)stream->mapped_page_size;
+        stream->mapped_remaining--;
+        count++;
+    }
+    stream->cursor = cursor;
+    return count;
+}
+
+static int read_trace_entries(TraceStream* stream, TraceEntry* entries, int max_entries) {
+    if (stream->mapped) return decode_binary_trace(stream, entries, max_entries);
+    return read_text_trace(stream->file, entries, max_entries);
+}
+
+TraceStream* open_trace_stream(const char* path, int lookahead, int window, int page_shift) {
+    TraceStream* stream = (TraceStream*)calloc(1, sizeof(TraceStream));
+    stream->page_shift = page_shift;
+    if (strcmp(path, "-") == 0) {
+        stream->file = stdin;
+    } else {
+        int mapped = map_binary_trace(stream, path);
+        if (mapped == 0) stream->file = fopen(path, "r");
+        if (mapped == -1 || (mapped == 0 && !stream->file)) {
+            free(stream);
+            return NULL;
+        }
+    }
+    stream->chunk_capacity = TRACE_CHUNK_ENTRIES;
+    stream->lookahead = lookahead;
+    stream->window = (lookahead == LOOKAHEAD_WINDOW) ? window : 0;
+    stream->buffer = (TraceEntry*)malloc((size_t)(stream->chunk_capacity + stream->window) * sizeof(TraceEntry));
+    if (lookahead != LOOKAHEAD_NONE) {
+        stream->next_use = (long long*)malloc((size_t)stream->chunk_capacity * sizeof(long long));
+    }
+    if (lookahead == LOOKAHEAD_WINDOW) {
+        stream->scratch = create_page_index(stream->chunk_capacity + stream->window);
+    }
+    return stream;
+}
+
+// An in-memory trace is handed out in place; its lookahead is always exact.
+TraceStream* open_memory_trace_stream(TraceEntry* entries, int count, int lookahead, int page_shift) {
+    TraceStream* stream = (TraceStream*)calloc(1, sizeof(TraceStream));
+    stream->page_shift = page_shift;
+    stream->memory = entries;
+    stream->memory_size = count;
+    stream->chunk_capacity = TRACE_CHUNK_ENTRIES;
+    stream->lookahead = lookahead;
+    if (lookahead != LOOKAHEAD_NONE) stream->memory_next_use = compute_next_use(entries, count, page_shift);
+    return stream;
+}
+
+// Two-pass lookahead: copy the whole source to a temporary file, then walk
+// it backwards one chunk at a time, writing each entry's next-use index to
+// a second file at the matching offset. Memory stays bounded by one chunk
+// plus one slot per distinct page.
+static int spill_trace_stream(TraceStream* stream) {
+    stream->spill = tmpfile();
+    stream->spill_next_use = tmpfile();
+    if (!stream->spill || !stream->spill_next_use) {
+        perror("Failed to create lookahead spill file");
+        return -1;
+    }
+
+    long long total = 0;
+    int count;
+    while ((count = read_trace_entries(stream, stream->buffer, stream->chunk_capacity)) > 0) {
+        fwrite(stream->buffer, sizeof(TraceEntry), count, stream->spill);
+        total += count;
+    }
+
+    PageIndex* page_ids = create_page_index(stream->chunk_capacity);
+    int id_capacity = stream->chunk_capacity;
+    long long* next_seen = (long long*)malloc((size_t)id_capacity * sizeof(long long));
+    for (long long end = total; end > 0; ) {
+        long long start = end > stream->chunk_capacity ? end - stream->chunk_capacity : 0;
+        int block = (int)(end - start);
+        fseeko(stream->spill, start * (off_t)sizeof(TraceEntry), SEEK_SET);
+        if (fread(stream->buffer, sizeof(TraceEntry), block, stream->spill) != (size_t)block) return -1;
+        for (int i = block - 1; i >= 0; i--) {
+            uint64_t page_number = trace_page(&stream->buffer[i], stream->page_shift);
+            int id = page_index_lookup(page_ids, page_number);
+            if (id == -1) {
+                id = page_ids->count;
+                page_index_insert(page_ids, page_number, id);
+                if (id == id_capacity) {
+                    id_capacity *= 2;
+                    next_seen = (long long*)realloc(next_seen, (size_t)id_capacity * sizeof(long long));
+                }
+                next_seen[id] = NEVER_USED;
+            }
+            stream->next_use[i] = next_seen[id];
+            next_seen[id] = start + i;
+        }
+        fseeko(stream->spill_next_use, start * (off_t)sizeof(long long), SEEK_SET);
+        fwrite(stream->next_use, sizeof(long long), block, stream->spill_next_use);
+        end = start;
+    }
+    free(next_seen);
+    free_page_index(page_ids);
+    rewind(stream->spill);
+    rewind(stream->spill_next_use);
+    return 0;
+}
+
+static int trace_stream_fill(TraceStream* stream) {
+    int consumed = stream->chunk_size;
+    stream->position += consumed;
+
+    if (stream->memory) {
+        long long remaining = stream->memory_size - stream->position;
+        stream->chunk_size = remaining < stream->chunk_capacity ? (int)remaining : stream->chunk_capacity;
+        stream->chunk = stream->memory + stream->position;
+        if (stream->memory_next_use) stream->next_use = stream->memory_next_use + stream->position;
+        return stream->chunk_size;
+    }
+
+    if (stream->lookahead == LOOKAHEAD_TWO_PASS) {
+        if (!stream->spill && spill_trace_stream(stream) != 0) {
+            stream->chunk_size = 0;
+            return 0;
+        }
+        stream->chunk = stream->buffer;
+        stream->chunk_size = (int)fread(stream->buffer, sizeof(TraceEntry), stream->chunk_capacity, stream->spill);
+        if (fread(stream->next_use, sizeof(long long), stream->chunk_size, stream->spill_next_use) != (size_t)stream->chunk_size) {
+            stream->chunk_size = 0;
+        }
+        return stream->chunk_size;
+    }
+
+    // Plain and windowed streams keep the unconsumed tail of the buffer,
+    // which is the lookahead window, and top it up from the file.
+    stream->buffered -= consumed;
+    memmove(stream->buffer, stream->buffer + consumed, (size_t)stream->buffered * sizeof(TraceEntry));
+    stream->buffered += read_trace_entries(stream, stream->buffer + stream->buffered,
+                                           stream->chunk_capacity + stream->window - stream->buffered);
+    stream->chunk = stream->buffer;
+    stream->chunk_size = stream->buffered < stream->chunk_capacity ? stream->buffered : stream->chunk_capacity;
+
+    // Windowed MIN only sees references inside the buffer; anything beyond
+    // it counts as never used again, which approximates MIN.
+    if (stream->lookahead == LOOKAHEAD_WINDOW) {
+        page_index_clear(stream->scratch);
+        for (int i = stream->buffered - 1; i >= 0; i--) {
+            uint64_t page_number = trace_page(&stream->buffer[i], stream->page_shift);
+            int next = page_index_lookup(stream->scratch, page_number);
+            if (i < stream->chunk_size) stream->next_use[i] = (next == -1) ? NEVER_USED : stream->position + next;
+            page_index_insert(stream->scratch, page_number, i);
+        }
+    }
+    return stream->chunk_size;
+}
+
+// Advance to the next chunk; returns its length, 0 once the trace is done.
+int trace_stream_next(TraceStream* stream) {
+    int count = trace_stream_fill(stream);
+    if (stream->tee) {
+        for (int i = 0; i < count; i++) trace_writer_append(stream->tee, &stream->chunk[i]);
+    }
+    return count;
+}
+
+void close_trace_stream(TraceStream* stream) {
+    if (stream->file && stream->file != stdin) fclose(stream->file);
+    if (stream->mapped) munmap((void*)stream->mapped, stream->mapped_size);
+    if (stream->spill) fclose(stream->spill);
+    if (stream->spill_next_use) fclose(stream->spill_next_use);
+    if (stream->scratch) free_page_index(stream->scratch);
+    if (stream->memory) {
+        free(stream->memory_next_use);
+    } else {
+        free(stream->buffer);
+        free(stream->next_use);
+    }
+    free(stream);
+}
+
+// The kernel truncates command names to 15 characters.
+static void read_process_command(pid_t pid, char* command, size_t size) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/comm", (int)pid);
+    command[0] = '\0';
+    FILE* fp = fopen(path, "r");
+    if (!fp) return;
+    if (fgets(command, (int)size, fp) != NULL) command[strcspn(command, "\n")] = '\0';
+    fclose(fp);
+}
+
+static void process_trace_append(ProcessTrace* process, char operation, uint64_t address) {
+    if (process->count == process->capacity) {
+        process->capacity = process->capacity ? process->capacity * 2 : 1024;
+        process->entries = (TraceEntry*)realloc(process->entries, (size_t)process->capacity * sizeof(TraceEntry));
+    }
+    process->entries[process->count].operation = operation;
+    process->entries[process->count].asid = 0;
+    process->entries[process->count].address = address;
+    process->count++;
+}
+
+// Expand one process's /proc/PID/maps into a synthetic trace: a burst of
+// loads on each of its first pages and a burst of stores at the start of
+// every mapping. seed keeps the burst lengths thread-safe.
+static void collect_process_trace(ProcessTrace* process, unsigned int* seed) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/maps", (int)process->pid);
+    FILE *fp = fopen(path, "r");
+    if (!fp) return;
+
+    char line[4352];
+    int unique_pages = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        unsigned long long start, end;
+        char perms[5];
+        if (sscanf(line, "%llx-%llx %4s", &start, &end, perms) != 3) continue;
+
+        for (uint64_t addr = start; addr < end && unique_pages < PROCESS_TRACE_PAGES; addr += PAGE_SIZE) {
+            int repeats = 3 + rand_r(seed) % 3;
+            for (int i = 0; i < repeats; i++) process_trace_append(process, 'l', addr);
+            unique_pages++;
+        }
+        int repeats = 3 + rand_r(seed) % 3;
+        for (int i = 0; i < repeats; i++) process_trace_append(process, 's', start);
+        unique_pages++;
+    }
+    fclose(fp);
+}
+
+// A term that parses as a number is a PID, anything else a command name.
+static ProcessFilter* parse_process_filter(const char* filter) {
+    ProcessFilter* parsed = (ProcessFilter*)calloc(1, sizeof(ProcessFilter));
+    parsed->text = strdup(filter);
+    size_t terms = 1;
+    for (const char* c = filter; *c; c++) terms += (*c == ',');
+    parsed->pids = (pid_t*)malloc(sizeof(pid_t) * terms);
+    parsed->names = (const char**)malloc(sizeof(const char*) * terms);
+    for (char* token = strtok(parsed->text, ","); token; token = strtok(NULL, ",")) {
+        char* end;
+        long pid = strtol(token, &end, 10);
+        if (*end == '\0') parsed->pids[parsed->pid_count++] = (pid_t)pid;
+        else parsed->names[parsed->name_count++] = token;
+    }
+    return parsed;
+}
+
+static void free_process_filter(ProcessFilter* filter) {
+    free(filter->text);
+    free(filter->pids);
+    free(filter->names);
+    free(filter);
+}
+
+static int process_matches(ProcessTrace* process, const ProcessFilter* filter) {
+    if (!filter) return 1;
+    for (int i = 0; i < filter->pid_count; i++) {
+        if (filter->pids[i] == process->pid) return 1;
+    }
+    for (int i = 0; i < filter->name_count; i++) {
+        if (strcmp(filter->names[i], process->command) == 0) return 1;
+    }
+    return 0;
+}
+
+// Each worker takes the next PID, reads its command name, and traces it if
+// it passes the filter. Processes that exit or cannot be read yield no
+// references and are dropped when the traces are merged.
+static void* process_scan_worker(void* arg) {
+    ProcessScanPool* pool = (ProcessScanPool*)arg;
+    unsigned int seed = (unsigned int)time(NULL) ^ (unsigned int)(uintptr_t)&seed;
+    while (1) {
+        pthread_mutex_lock(&pool->lock);
+        int index = pool->next_process++;
+        pthread_mutex_unlock(&pool->lock);
+        if (index >= pool->process_count) break;
+
+        ProcessTrace* process = &pool->processes[index];
+        read_process_command(process->pid, process->command, sizeof(process->command));
+        if (process->command[0] && process_matches(process, pool->filter)) collect_process_trace(process, &seed);
+    }
+    return NULL;
+}
+
+// Trace every process in /proc (or those named in filter: PIDs and command
+// names, comma-separated) with a pool of worker threads, then interleave
+// the traces in round-robin quanta into the global trace as if the
+// processes were time-sliced on one CPU. Each process gets its own ASID,
+// so they all compete for one physical memory. Returns the process count.
+int list_processes_and_trace(const char* filter, int threads) {
+    struct dirent *entry;
+    DIR *dp = opendir("/proc");
+    if (dp == NULL) {
+        perror("Error: Unable to open /proc. Try running as root.");
+        exit(1);
+    }
+
+    ProcessScanPool pool;
+    pool.processes = NULL;
+    pool.process_count = 0;
+    pool.next_process = 0;
+    // Parsed here, once, so the workers only compare.
+    ProcessFilter* parsed = filter ? parse_process_filter(filter) : NULL;
+    pool.filter = parsed;
+    int capacity = 0;
+    pid_t self = getpid();
+    while ((entry = readdir(dp)) != NULL) {
+        if (!isdigit((unsigned char)entry->d_name[0])) continue;
+        pid_t pid = (pid_t)atoi(entry->d_name);
+        if (pid == self) continue;
+        if (pool.process_count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            pool.processes = (ProcessTrace*)realloc(pool.processes, (size_t)capacity * sizeof(ProcessTrace));
+        }
+        memset(&pool.processes[pool.process_count], 0, sizeof(ProcessTrace));
+        pool.processes[pool.process_count++].pid = pid;
+    }
+    closedir(dp);
+
+    pthread_mutex_init(&pool.lock, NULL);
+    if (threads > pool.process_count) threads = pool.process_count > 0 ? pool.process_count : 1;
+    pthread_t* workers = (pthread_t*)malloc(sizeof(pthread_t) * threads);
+    for (int t = 0; t < threads; t++) pthread_create(&workers[t], NULL, process_scan_worker, &pool);
+    for (int t = 0; t < threads; t++) pthread_join(workers[t], NULL);
+    free(workers);
+    pthread_mutex_destroy(&pool.lock);
+    if (parsed) free_process_filter(parsed);
+
+    int traced = 0;
+    trace_processes = (ProcessInfo*)calloc(pool.process_count > 0 ? pool.process_count : 1, sizeof(ProcessInfo));
+    for (int i = 0; i < pool.process_count; i++) {
+        ProcessTrace* process = &pool.processes[i];
+        if (process->count == 0) continue;
+        if (traced == MAX_ASIDS) {
+            fprintf(stderr, "Only the first %d processes are traced\n", MAX_ASIDS);
+            break;
+        }
+        process->asid = traced;
+        trace_processes[traced].pid = process->pid;
+        memcpy(trace_processes[traced].command, process->command, sizeof(process->command));
+        trace_processes[traced].references = process->count;
+        // Swap the traced processes to the front; every slot keeps one owner.
+        ProcessTrace kept = *process;
+        pool.processes[i] = pool.processes[traced];
+        pool.processes[traced++] = kept;
+    }
+    trace_process_count = traced;
+
+    for (int offset = 0, merged = 1; merged; offset += PROCESS_TRACE_QUANTUM) {
+        merged = 0;
+        for (int i = 0; i < traced; i++) {
+            ProcessTrace* process = &pool.processes[i];
+            for (int k = offset; k < process->count && k < offset + PROCESS_TRACE_QUANTUM; k++) {
+                add_trace_entry(process->entries[k].operation, process->entries[k].address, process->asid);
+                merged = 1;
+            }
+        }
+    }
+    for (int i = 0; i < pool.process_count; i++) free(pool.processes[i].entries);
+    free(pool.processes);
+    return traced;
+}
+
+static long perf_event_open(struct perf_event_attr* attr, pid_t pid, int cpu, int group_fd, unsigned long flags) {
+    return syscall(SYS_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+// Fill attr from a named event of the core PMU, e.g. mem-loads is
+// "event=0xcd,umask=0x1,ldlat=3" on Intel. Each term's bit placement comes
+// from the PMU's format directory ("config:0-7", "config1:0-15").
+static int perf_pmu_event_config(const char* name, struct perf_event_attr* attr) {
+    char path[256];
+    char terms[256];
+    snprintf(path, sizeof(path), PERF_PMU_PATH "/type");
+    FILE* fp = fopen(path, "r");
+    if (!fp) return -1;
+    int ok = fscanf(fp, "%u", &attr->type) == 1;
+    fclose(fp);
+    if (!ok) return -1;
+
+    snprintf(path, sizeof(path), PERF_PMU_PATH "/events/%s", name);
+    fp = fopen(path, "r");
+    if (!fp) return -1;
+    ok = fgets(terms, sizeof(terms), fp) != NULL;
+    fclose(fp);
+    if (!ok) return -1;
+
+    for (char* term = strtok(terms, ",\n"); term; term = strtok(NULL, ",\n")) {
+        char* equals = strchr(term, '=');
+        unsigned long long value = equals ? strtoull(equals + 1, NULL, 0) : 1;
+        if (equals) *equals = '\0';
+
+        char format[64];
+        int low, high;
+        snprintf(path, sizeof(path), PERF_PMU_PATH "/format/%s", term);
+        fp = fopen(path, "r");
+        if (!fp) return -1;
+        int fields = fscanf(fp, "%63[^:]:%d-%d", format, &low, &high);
+        fclose(fp);
+        if (fields < 2) return -1;
+        if (fields == 2) high = low;
+
+        __u64* config = strcmp(format, "config") == 0 ? &attr->config
+                      : strcmp(format, "config1") == 0 ? &attr->config1
+                      : strcmp(format, "config2") == 0 ? &attr->config2 : NULL;
+        if (!config) return -1;
+        unsigned long long mask = (high - low == 63) ? ~0ULL : ((1ULL << (high - low + 1)) - 1);
+        *config |= (value & mask) << low;
+    }
+    return 0;
+}
+
+// Open one sampling event per CPU on the target and map their rings.
+// Spawned commands start disabled and are enabled by their exec, so the
+// shell's own start-up is skipped; a running process is sampled at once.
+// Returns the number of CPUs the event could be opened on.
+static int capture_open_event(CaptureSession* session, struct perf_event_attr* attr, char operation) {
+    attr->size = sizeof(*attr);
+    attr->sample_type = PERF_SAMPLE_ADDR;
+    attr->exclude_kernel = 1;
+    attr->exclude_hv = 1;
+    attr->inherit = 1;
+    attr->disabled = session->spawned;
+    attr->enable_on_exec = session->spawned;
+    // Wake the poll loop once a quarter of the ring has filled instead of
+    // on every sample.
+    attr->watermark = 1;
+    attr->wakeup_watermark = (CAPTURE_RING_PAGES / 4) * (unsigned)sysconf(_SC_PAGESIZE);
+
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    int cpus = (int)sysconf(_SC_NPROCESSORS_CONF);
+    int opened = 0;
+    for (int cpu = 0; cpu < cpus; cpu++) {
+        int fd = (int)perf_event_open(attr, session->pid, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+        if (fd < 0) continue;
+        CaptureEvent* event = &session->events[session->event_count];
+        event->data_size = CAPTURE_RING_PAGES * page_size;
+        event->ring_size = page_size + event->data_size;
+        event->ring = (struct perf_event_mmap_page*)mmap(NULL, event->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (event->ring == MAP_FAILED) {
+            close(fd);
+            continue;
+        }
+        event->fd = fd;
+        event->operation = operation;
+        session->event_count++;
+        opened++;
+    }
+    return opened;
+}
+
+// Precise load and store sampling where the CPU has it; otherwise fall
+// back to page faults, which every kernel can sample with an address.
+static int open_capture_session(CaptureSession* session, long period) {
+    struct perf_event_attr attr;
+    const char* names[] = {"mem-loads", "mem-stores"};
+    const char operations[] = {'l', 's'};
+    session->events = (CaptureEvent*)calloc(2 * sysconf(_SC_NPROCESSORS_CONF), sizeof(CaptureEvent));
+    for (int i = 0; i < 2; i++) {
+        memset(&attr, 0, sizeof(attr));
+        if (perf_pmu_event_config(names[i], &attr) != 0) continue;
+        attr.sample_period = period;
+        attr.precise_ip = 2;
+        if (capture_open_event(session, &attr, operations[i]) == 0) {
+            attr.precise_ip = 1;
+            capture_open_event(session, &attr, operations[i]);
+        }
+    }
+    if (session->event_count > 0) {
+        session->backend = "PEBS load/store sampling";
+        return 0;
+    }
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.config = PERF_COUNT_SW_PAGE_FAULTS;
+    attr.sample_period = 1;
+    if (capture_open_event(session, &attr, 'l') > 0) {
+        session->backend = "page-fault sampling";
+        return 0;
+    }
+    return -1;
+}
+
+static void capture_copy(CaptureEvent* event, uint64_t offset, void* out, size_t length) {
+    const unsigned char* data = (const unsigned char*)event->ring + (event->ring_size - event->data_size);
+    size_t start = offset & (event->data_size - 1);
+    size_t first = event->data_size - start < length ? event->data_size - start : length;
+    memcpy(out, data + start, first);
+    memcpy((unsigned char*)out + first, data, length - first);
+}
+
+// Move every complete record out of the ring into the trace buffer and
+// hand the space back to the kernel.
+static void capture_drain(CaptureSession* session, CaptureEvent* event) {
+    uint64_t head = __atomic_load_n(&event->ring->data_head, __ATOMIC_ACQUIRE);
+    uint64_t tail = event->ring->data_tail;
+    while (tail < head) {
+        struct perf_event_header header;
+        capture_copy(event, tail, &header, sizeof(header));
+        if (header.size == 0) break;
+        if (header.type == PERF_RECORD_SAMPLE) {
+            uint64_t address;
+            capture_copy(event, tail + sizeof(header), &address, sizeof(address));
+            if (address) {
+                add_trace_entry(event->operation, address, 0);
+                session->samples++;
+            }
+        } else if (header.type == PERF_RECORD_LOST) {
+            uint64_t lost[2];
+            capture_copy(event, tail + sizeof(header), lost, sizeof(lost));
+            session->lost += lost[1];
+        }
+        tail += header.size;
+    }
+    __atomic_store_n(&event->ring->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+static void close_capture_session(CaptureSession* session) {
+    for (int i = 0; i < session->event_count; i++) {
+        munmap(session->events[i].ring, session->events[i].ring_size);
+        close(session->events[i].fd);
+    }
+    free(session->events);
+    session->events = NULL;
+    session->event_count = 0;
+}
+
+// The child blocks on the pipe until the parent has attached its events,
+// so no reference made after the exec is missed. It leads its own process
+// group so the whole command can be stopped when the capture ends.
+static pid_t spawn_capture_command(const char* command, int* go) {
+    int fds[2];
+    if (pipe(fds) != 0) return -1;
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        char byte;
+        close(fds[1]);
+        setpgid(0, 0);
+        if (read(fds[0], &byte, 1) != 1) _exit(127);
+        execl("/bin/sh", "sh", "-c", command, (char*)NULL);
+        _exit(127);
+    }
+    close(fds[0]);
+    *go = fds[1];
+    return pid;
+}
+
+static volatile sig_atomic_t capture_interrupted = 0;
+
+static void capture_on_interrupt(int signal_number) {
+    (void)signal_number;
+    capture_interrupted = 1;
+}
+
+// Record the page references of a running process (pid) or of a command
+// started here, appending them to the trace buffer as they arrive. Stops
+// when the process exits, after seconds (if positive) or on Ctrl-C.
+int capture_trace(pid_t pid, const char* command, double seconds, long period) {
+    CaptureSession session;
+    memset(&session, 0, sizeof(session));
+    int go = -1;
+    if (command) {
+        pid = spawn_capture_command(command, &go);
+        if (pid < 0) {
+            perror("Failed to start command");
+            return -1;
+        }
+        session.spawned = 1;
+    }
+    session.pid = pid;
+    if (open_capture_session(&session, period) != 0) {
+        perror("Failed to open perf events (check /proc/sys/kernel/perf_event_paranoid)");
+        close_capture_session(&session);
+        if (session.spawned) {
+            close(go);
+            waitpid(pid, NULL, 0);
+        }
+        return -1;
+    }
+    fprintf(stderr, "Capturing process %d with %s\n", (int)pid, session.backend);
+    if (session.spawned) {
+        if (write(go, "", 1) != 1) perror("Failed to start command");
+        close(go);
+    }
+
+    struct sigaction action, previous;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = capture_on_interrupt;
+    sigaction(SIGINT, &action, &previous);
+    capture_interrupted = 0;
+
+    struct pollfd* fds = (struct pollfd*)calloc(session.event_count, sizeof(struct pollfd));
+    for (int i = 0; i < session.event_count; i++) {
+        fds[i].fd = session.events[i].fd;
+        fds[i].events = POLLIN;
+    }
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int running = 1;
+    while (running && !capture_interrupted) {
+        poll(fds, session.event_count, CAPTURE_POLL_MS);
+        for (int i = 0; i < session.event_count; i++) {
+            capture_drain(&session, &session.events[i]);
+            if (fds[i].revents & POLLHUP) running = 0;
+        }
+        if (session.spawned && waitpid(pid, NULL, WNOHANG) == pid) {
+            running = 0;
+            session.spawned = 0;
+        } else if (!session.spawned && kill(pid, 0) != 0 && errno == ESRCH) {
+            running = 0;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (seconds > 0 && (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9 >= seconds) break;
+    }
+    for (int i = 0; i < session.event_count; i++) capture_drain(&session, &session.events[i]);
+    sigaction(SIGINT, &previous, NULL);
+    free(fds);
+
+    // A command still running when the capture ends is stopped with it.
+    if (session.spawned) {
+        if (running) kill(-pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+    }
+    fprintf(stderr, "Captured %llu samples", session.samples);
+    if (session.lost) fprintf(stderr, ", %llu lost to ring overflow", session.lost);
+    fprintf(stderr, "\n");
+    close_capture_session(&session);
+    return 0;
+}
+
+static int compare_idle_pages(const void* a, const void* b) {
+    uint64_t x = ((const IdlePage*)a)->pfn;
+    uint64_t y = ((const IdlePage*)b)->pfn;
+    return (x > y) - (x < y);
+}
+
+// Resolve every present page of the process to its PFN through pagemap,
+// sorted by PFN so the bitmap is touched one 64-bit word at a time.
+static int idle_scan_process(IdleTarget* target) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/maps", (int)target->pid);
+    FILE* maps = fopen(path, "r");
+    if (!maps) return -1;
+    snprintf(path, sizeof(path), "/proc/%d/pagemap", (int)target->pid);
+    int pagemap = open(path, O_RDONLY);
+    if (pagemap < 0) {
+        fclose(maps);
+        return -1;
+    }
+
+    char line[4352];
+    uint64_t entries[512];
+    target->count = 0;
+    while (fgets(line, sizeof(line), maps) != NULL) {
+        unsigned long long start, end;
+        if (sscanf(line, "%llx-%llx", &start, &end) != 2) continue;
+        uint64_t page = start / PAGE_SIZE;
+        while (page < end / PAGE_SIZE) {
+            uint64_t batch = end / PAGE_SIZE - page < 512 ? end / PAGE_SIZE - page : 512;
+            ssize_t got = pread(pagemap, entries, batch * sizeof(uint64_t), (off_t)(page * sizeof(uint64_t)));
+            if (got <= 0) break;
+            for (int i = 0; i < (int)(got / sizeof(uint64_t)); i++) {
+                // Without CAP_SYS_ADMIN the kernel reports every PFN as 0.
+                if (!(entries[i] & PAGEMAP_PRESENT) || !(entries[i] & PAGEMAP_PFN_MASK)) continue;
+                if (target->count == target->capacity) {
+                    target->capacity = target->capacity ? target->capacity * 2 : 4096;
+                    target->pages = (IdlePage*)realloc(target->pages, (size_t)target->capacity * sizeof(IdlePage));
+                }
+                target->pages[target->count].pfn = entries[i] & PAGEMAP_PFN_MASK;
+                target->pages[target->count].address = (page + i) * PAGE_SIZE;
+                target->count++;
+            }
+            page += got / sizeof(uint64_t);
+        }
+    }
+    close(pagemap);
+    fclose(maps);
+    qsort(target->pages, target->count, sizeof(IdlePage), compare_idle_pages);
+    return 0;
+}
+
+// Setting a bit marks the page idle; zero bits in the word are ignored.
+// Words past the end of the bitmap (device memory) cannot be written and
+// those pages read back as idle.
+static void idle_mark(int bitmap, IdleTarget* target) {
+    for (int i = 0; i < target->count; ) {
+        uint64_t word = target->pages[i].pfn / 64;
+        uint64_t bits = 0;
+        for (; i < target->count && target->pages[i].pfn / 64 == word; i++) {
+            bits |= 1ULL << (target->pages[i].pfn % 64);
+        }
+        pwrite(bitmap, &bits, sizeof(bits), (off_t)(word * sizeof(bits)));
+    }
+}
+
+// A page whose idle bit has been cleared was accessed since it was marked;
+// each one becomes a single reference in the trace. Returns the count.
+static long long idle_collect(int bitmap, IdleTarget* target) {
+    long long accessed = 0;
+    for (int i = 0; i < target->count; ) {
+        uint64_t word = target->pages[i].pfn / 64;
+        uint64_t bits;
+        if (pread(bitmap, &bits, sizeof(bits), (off_t)(word * sizeof(bits))) != sizeof(bits)) bits = ~0ULL;
+        for (; i < target->count && target->pages[i].pfn / 64 == word; i++) {
+            if (bits & (1ULL << (target->pages[i].pfn % 64))) continue;
+            add_trace_entry('l', target->pages[i].address, target->asid);
+            accessed++;
+        }
+    }
+    return accessed;
+}
+
+// Working-set sampler: every interval, mark all present pages of each
+// process idle, wait, and count the ones touched meanwhile. Prints the
+// working set per process and interval and appends the touched pages to
+// the trace buffer, giving a coarse trace with one reference per page per
+// interval. Runs until every process has exited, after seconds (if
+// positive) or on Ctrl-C.
+int sample_idle_pages(pid_t* pids, int count, int interval_ms, double seconds) {
+    int bitmap = open(PAGE_IDLE_BITMAP, O_RDWR);
+    if (bitmap < 0) {
+        perror("Failed to open " PAGE_IDLE_BITMAP " (needs CONFIG_IDLE_PAGE_TRACKING and root)");
+        return -1;
+    }
+
+    IdleTarget* targets = (IdleTarget*)calloc(count, sizeof(IdleTarget));
+    int alive = 0;
+    trace_processes = (ProcessInfo*)calloc(count, sizeof(ProcessInfo));
+    trace_process_count = count;
+    for (int i = 0; i < count; i++) {
+        targets[i].pid = pids[i];
+        targets[i].asid = (uint16_t)i;
+        trace_processes[i].pid = pids[i];
+        read_process_command(pids[i], trace_processes[i].command, sizeof(trace_processes[i].command));
+        if (idle_scan_process(&targets[i]) != 0) {
+            fprintf(stderr, "Cannot read the page map of process %d\n", (int)pids[i]);
+            targets[i].pid = 0;
+            continue;
+        }
+        idle_mark(bitmap, &targets[i]);
+        alive++;
+    }
+
+    struct sigaction action, previous;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = capture_on_interrupt;
+    sigaction(SIGINT, &action, &previous);
+    capture_interrupted = 0;
+
+    if (alive) printf("%8s %8s %12s %12s\n", "Interval", "PID", "WSS pages", "WSS");
+    for (int interval = 1; alive && !capture_interrupted; interval++) {
+        poll(NULL, 0, interval_ms);
+        alive = 0;
+        for (int i = 0; i < count; i++) {
+            if (!targets[i].pid) continue;
+            long long accessed = idle_collect(bitmap, &targets[i]);
+            trace_processes[i].references += accessed;
+            printf("%8d %8d %12lld %11lluK\n", interval, (int)targets[i].pid, accessed,
+                   (unsigned long long)accessed * PAGE_SIZE / 1024);
+            if (idle_scan_process(&targets[i]) != 0) {
+                targets[i].pid = 0;
+                continue;
+            }
+            idle_mark(bitmap, &targets[i]);
+            alive++;
+        }
+        if (seconds > 0 && interval * (interval_ms / 1000.0) >= seconds) break;
+    }
+    sigaction(SIGINT, &previous, NULL);
+
+    for (int i = 0; i < count; i++) free(targets[i].pages);
+    free(targets);
+    close(bitmap);
+    return 0;
+}
+
+PageTable* create_page_table(int size) {
+    PageTable* pt = (PageTable*)malloc(sizeof(PageTable));
+    pt->referenced = (uint8_t*)calloc(size, sizeof(uint8_t));
+    pt->dirty = (uint8_t*)calloc(size, sizeof(uint8_t));
+    pt->valid = (uint8_t*)calloc(size, sizeof(uint8_t));
+    pt->index = create_page_index(size);
+    pt->size = size;
+    pt->page_faults = 0;
+    pt->hits = 0;
+    pt->misses = 0;
+    pt->read_faults = 0;
+    pt->write_faults = 0;
+    pt->write_backs = 0;
+    pt->asid_faults = NULL;
+    pt->asid_evictions = NULL;
+    pt->asid_count = 0;
+    return pt;
+}
+
+void page_table_track_asids(PageTable* pt, int asid_count) {
+    pt->asid_faults = (long long*)calloc(asid_count, sizeof(long long));
+    pt->asid_evictions = (long long*)calloc(asid_count, sizeof(long long));
+    pt->asid_count = asid_count;
+}
+
+// Open-addressing (linear probing) map from page number to frame number.
+// Capacity is a power of two at least twice the frame count, so the load
+// factor never exceeds 1/2. A slot is empty when its frame is -1. Sizes
+// are size_t since twice a frame count near INT_MAX does not fit an int.
+PageIndex* create_page_index(int size) {
+    PageIndex* index = (PageIndex*)malloc(sizeof(PageIndex));
+    size_t capacity = 16;
+    int shift = 60;
+    while (capacity < 2 * (size_t)size) {
+        capacity <<= 1;
+        shift--;
+    }
+    index->keys = (uint64_t*)calloc(capacity, sizeof(uint64_t));
+    index->frames = (int*)calloc(capacity, sizeof(int));
+    for (size_t i = 0; i < capacity; i++) index->frames[i] = -1;
+    index->capacity = capacity;
+    index->mask = capacity - 1;
+    index->shift = shift;
+    index->count = 0;
+    return index;
+}
+
+// Fibonacci hashing: the top bits of page * 2^64/phi select the slot.
+static inline size_t page_index_slot(PageIndex* index, uint64_t page_number) {
+    return (size_t)((page_number * 0x9E3779B97F4A7C15ull) >> index->shift);
+}
+
+int page_index_lookup(PageIndex* index, uint64_t page_number) {
+    size_t slot = page_index_slot(index, page_number);
+    while (index->frames[slot] != -1) {
+        if (index->keys[slot] == page_number) return index->frames[slot];
+        slot = (slot + 1) & index->mask;
+    }
+    return -1;
+}
+
+// Double the table and rehash. Page tables are sized for their frame count
+// and never grow; maps over a whole trace grow as new pages appear.
+static void page_index_grow(PageIndex* index) {
+    size_t old_capacity = index->capacity;
+    uint64_t* old_keys = index->keys;
+    int* old_frames = index->frames;
+    index->capacity *= 2;
+    index->mask = index->capacity - 1;
+    index->shift--;
+    index->count = 0;
+    index->keys = (uint64_t*)calloc(index->capacity, sizeof(uint64_t));
+    index->frames = (int*)calloc(index->capacity, sizeof(int));
+    for (size_t i = 0; i < index->capacity; i++) index->frames[i] = -1;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_frames[i] != -1) page_index_insert(index, old_keys[i], old_frames[i]);
+    }
+    free(old_keys);
+    free(old_frames);
+}
+
+void page_index_clear(PageIndex* index) {
+    for (size_t i = 0; i < index->capacity; i++) index->frames[i] = -1;
+    index->count = 0;
+}
+
+void page_index_insert(PageIndex* index, uint64_t page_number, int frame_number) {
+    if (2 * (size_t)(index->count + 1) > index->capacity) page_index_grow(index);
+    size_t slot = page_index_slot(index, page_number);
+    while (index->frames[slot] != -1) {
+        if (index->keys[slot] == page_number) {
+            index->frames[slot] = frame_number;
+            return;
+        }
+        slot = (slot + 1) & index->mask;
+    }
+    index->keys[slot] = page_number;
+    index->frames[slot] = frame_number;
+    index->count++;
+}
+
+// Backward-shift deletion keeps probe chains intact without tombstones.
+void page_index_remove(PageIndex* index, uint64_t page_number) {
+    size_t slot = page_index_slot(index, page_number);
+    while (index->frames[slot] != -1 && index->keys[slot] != page_number) {
+        slot = (slot + 1) & index->mask;
+    }
+    if (index->frames[slot] == -1) return;
+
+    size_t hole = slot;
+    size_t next = (hole + 1) & index->mask;
+    while (index->frames[next] != -1) {
+        size_t home = page_index_slot(index, index->keys[next]);
+        if (((next - home) & index->mask) >= ((next - hole) & index->mask)) {
+            index->keys[hole] = index->keys[next];
+            index->frames[hole] = index->frames[next];
+            hole = next;
+        }
+        next = (next + 1) & index->mask;
+    }
+    index->frames[hole] = -1;
+    index->count--;
+}
+
+PhysicalMemory* create_physical_memory(int size) {
+    PhysicalMemory* pm = (PhysicalMemory*)malloc(sizeof(PhysicalMemory));
+    pm->frames = (uint64_t*)calloc(size, sizeof(uint64_t));
+    for (int i = 0; i < size; i++) pm->frames[i] = PAGE_NONE;
+    pm->size = size;
+    pm->next_frame = 0;
+    return pm;
+}
+
+FIFOQueue* create_fifo_queue(int size) {
+    FIFOQueue* fifo = (FIFOQueue*)malloc(sizeof(FIFOQueue));
+    fifo->frames = (int*)calloc(size, sizeof(int));
+    for (int i = 0; i < size; i++) fifo->frames[i] = -1;
+    fifo->size = size;
+    fifo->next_index = 0;
+    return fifo;
+}
+
+LRUQueue* create_lru_queue(int size) {
+    LRUQueue* lru = (LRUQueue*)malloc(sizeof(LRUQueue));
+    lru->frames = (int*)calloc(size, sizeof(int));
+    lru->prev = (int*)calloc(size, sizeof(int));
+    lru->next = (int*)calloc(size, sizeof(int));
+    for (int i = 0; i < size; i++) {
+        lru->frames[i] = -1;
+        lru->prev[i] = -1;
+        lru->next[i] = -1;
+    }
+    lru->head = -1;
+    lru->tail = -1;
+    lru->size = size;
+    return lru;
+}
+
+ClockQueue* create_clock_queue(int size) {
+    ClockQueue* clock = (ClockQueue*)malloc(sizeof(ClockQueue));
+    clock->frames = (int*)calloc(size, sizeof(int));
     clock->reference_bits = (int*)calloc(size, sizeof(int));
     for (int i = 0; i < size; i++) {
-        clock->pages[i] = -1;
         clock->frames[i] = -1;
         clock->reference_bits[i] = 0;
     }
-    clock->size = size;
-    clock->hand = 0;
-    return clock;
+    clock->size = size;
+    clock->hand = 0;
+    return clock;
+}
+
+SecondChanceQueue* create_second_chance_queue(int size) {
+    SecondChanceQueue* sc = (SecondChanceQueue*)malloc(sizeof(SecondChanceQueue));
+    sc->queue = (int*)calloc(size, sizeof(int));
+    sc->reference_bits = (int*)calloc(size, sizeof(int));
+    for (int i = 0; i < size; i++) sc->queue[i] = -1;
+    sc->head = 0;
+    sc->count = 0;
+    sc->size = size;
+    return sc;
+}
+
+NruQueue* create_nru_queue(int size) {
+    NruQueue* nru = (NruQueue*)malloc(sizeof(NruQueue));
+    nru->reference_bits = (int*)calloc(size, sizeof(int));
+    nru->dirty = NULL;
+    nru->size = size;
+    nru->hand = 0;
+    nru->references = 0;
+    return nru;
+}
+
+EnhancedClockQueue* create_enhanced_clock_queue(int size) {
+    EnhancedClockQueue* clock = (EnhancedClockQueue*)malloc(sizeof(EnhancedClockQueue));
+    clock->reference_bits = (int*)calloc(size, sizeof(int));
+    clock->dirty = NULL;
+    clock->size = size;
+    clock->hand = 0;
+    return clock;
+}
+
+MinQueue* create_min_queue(int size) {
+    MinQueue* min = (MinQueue*)malloc(sizeof(MinQueue));
+    min->heap = (int*)calloc(size, sizeof(int));
+    min->position = (int*)calloc(size, sizeof(int));
+    min->frame_next_use = (long long*)calloc(size, sizeof(long long));
+    for (int i = 0; i < size; i++) {
+        min->position[i] = -1;
+        min->frame_next_use[i] = NEVER_USED;
+    }
+    min->count = 0;
+    min->size = size;
+    // Borrowed from whoever owns the lookahead (see simulator_set_lookahead).
+    min->next_use = NULL;
+    return min;
+}
+
+// One backward pass: last_seen maps each page to the closest later index
+// at which it is referenced again. Pages never used again get NEVER_USED.
+long long* compute_next_use(TraceEntry* trace, int trace_size, int page_shift) {
+    long long* next_use = (long long*)calloc(trace_size > 0 ? trace_size : 1, sizeof(long long));
+    PageIndex* last_seen = create_page_index(trace_size);
+    for (int i = trace_size - 1; i >= 0; i--) {
+        uint64_t page_number = trace_page(&trace[i], page_shift);
+        int next = page_index_lookup(last_seen, page_number);
+        next_use[i] = (next == -1) ? NEVER_USED : next;
+        page_index_insert(last_seen, page_number, i);
+    }
+    free_page_index(last_seen);
+    return next_use;
+}
+
+MissCurve* create_miss_curve(int max_frames) {
+    MissCurve* curve = (MissCurve*)malloc(sizeof(MissCurve));
+    curve->distance_counts = (long long*)calloc(max_frames + 1, sizeof(long long));
+    curve->max_frames = max_frames;
+    curve->references = 0;
+    return curve;
+}
+
+PageNodes* create_page_nodes(int capacity, int frames) {
+    PageNodes* nodes = (PageNodes*)malloc(sizeof(PageNodes));
+    nodes->pages = (uint64_t*)calloc(capacity, sizeof(uint64_t));
+    nodes->frames = (int*)calloc(capacity, sizeof(int));
+    nodes->lists = (int*)calloc(capacity, sizeof(int));
+    nodes->prev = (int*)calloc(capacity, sizeof(int));
+    nodes->next = (int*)calloc(capacity, sizeof(int));
+    nodes->frame_nodes = (int*)calloc(frames, sizeof(int));
+    for (int i = 0; i < capacity; i++) {
+        nodes->pages[i] = PAGE_NONE;
+        nodes->frames[i] = -1;
+        nodes->lists[i] = -1;
+        nodes->prev[i] = -1;
+        nodes->next[i] = (i + 1 < capacity) ? i + 1 : -1;
+    }
+    for (int i = 0; i < frames; i++) nodes->frame_nodes[i] = -1;
+    nodes->index = create_page_index(capacity);
+    nodes->free_node = 0;
+    nodes->capacity = capacity;
+    return nodes;
+}
+
+static void node_list_init(NodeList* list) {
+    list->head = -1;
+    list->tail = -1;
+    list->length = 0;
+}
+
+ArcQueue* create_arc_queue(int size) {
+    ArcQueue* arc = (ArcQueue*)malloc(sizeof(ArcQueue));
+    // At most 2 * size pages are tracked once the ghost lists are trimmed.
+    arc->nodes = create_page_nodes(2 * size + 1, size);
+    for (int i = 0; i < 4; i++) node_list_init(&arc->lists[i]);
+    arc->target = 0;
+    arc->size = size;
+    arc->pending = -1;
+    arc->pending_list = -1;
+    arc->evict_t1 = 0;
+    return arc;
+}
+
+TwoQQueue* create_twoq_queue(int size) {
+    TwoQQueue* twoq = (TwoQQueue*)malloc(sizeof(TwoQQueue));
+    // The sizes the 2Q paper recommends: A1in a quarter of memory, A1out
+    // remembering half as many pages as fit in memory.
+    twoq->in_limit = size / 4 > 0 ? size / 4 : 1;
+    twoq->out_limit = size / 2 > 0 ? size / 2 : 1;
+    twoq->nodes = create_page_nodes(size + twoq->out_limit + 2, size);
+    for (int i = 0; i < 3; i++) node_list_init(&twoq->lists[i]);
+    twoq->size = size;
+    twoq->pending = -1;
+    return twoq;
+}
+
+LirsQueue* create_lirs_queue(int size) {
+    LirsQueue* lirs = (LirsQueue*)malloc(sizeof(LirsQueue));
+    // 1% of memory for HIR pages, as in the LIRS paper, and at least one
+    // frame unless memory is a single frame.
+    int hir_limit = size / 100 > 0 ? size / 100 : 1;
+    if (size < 2) hir_limit = 0;
+    lirs->lir_limit = size - hir_limit;
+    lirs->lir_count = 0;
+    // Non-resident HIR pages are capped at one per frame, oldest dropped first.
+    lirs->ghost_limit = size;
+    int capacity = size + lirs->ghost_limit + 2;
+    lirs->nodes = create_page_nodes(capacity, size);
+    node_list_init(&lirs->stack);
+    node_list_init(&lirs->queues[LIRS_QUEUE]);
+    node_list_init(&lirs->queues[LIRS_GHOSTS]);
+    lirs->queue_prev = (int*)calloc(capacity, sizeof(int));
+    lirs->queue_next = (int*)calloc(capacity, sizeof(int));
+    lirs->queue_lists = (int*)calloc(capacity, sizeof(int));
+    lirs->status = (int*)calloc(capacity, sizeof(int));
+    for (int i = 0; i < capacity; i++) {
+        lirs->queue_prev[i] = -1;
+        lirs->queue_next[i] = -1;
+        lirs->queue_lists[i] = -1;
+    }
+    lirs->size = size;
+    lirs->pending = -1;
+    return lirs;
+}
+
+ClockProQueue* create_clock_pro_queue(int size) {
+    ClockProQueue* cp = (ClockProQueue*)malloc(sizeof(ClockProQueue));
+    // Resident pages plus at most one non-resident page per frame.
+    int capacity = 2 * size + 2;
+    cp->nodes = create_page_nodes(capacity, size);
+    cp->hot = (int*)calloc(capacity, sizeof(int));
+    cp->reference_bits = (int*)calloc(capacity, sizeof(int));
+    cp->test = (int*)calloc(capacity, sizeof(int));
+    cp->hand_hot = -1;
+    cp->hand_cold = -1;
+    cp->hand_test = -1;
+    cp->hot_count = 0;
+    cp->nonresident_count = 0;
+    cp->cold_target = size / 100 > 0 ? size / 100 : 1;
+    cp->size = size;
+    cp->pending = -1;
+    cp->evicting = 0;
+    return cp;
+}
+
+void free_page_table(PageTable* pt) {
+    free_page_index(pt->index);
+    free(pt->referenced);
+    free(pt->dirty);
+    free(pt->valid);
+    free(pt->asid_faults);
+    free(pt->asid_evictions);
+    free(pt);
+}
+
+void free_page_index(PageIndex* index) {
+    free(index->keys);
+    free(index->frames);
+    free(index);
+}
+
+void free_physical_memory(PhysicalMemory* pm) {
+    free(pm->frames);
+    free(pm);
+}
+
+void free_fifo_queue(FIFOQueue* fifo) {
+    free(fifo->frames);
+    free(fifo);
+}
+
+void free_lru_queue(LRUQueue* lru) {
+    free(lru->frames);
+    free(lru->prev);
+    free(lru->next);
+    free(lru);
+}
+
+void free_clock_queue(ClockQueue* clock) {
+    free(clock->frames);
+    free(clock->reference_bits);
+    free(clock);
+}
+
+void free_second_chance_queue(SecondChanceQueue* sc) {
+    free(sc->queue);
+    free(sc->reference_bits);
+    free(sc);
+}
+
+void free_nru_queue(NruQueue* nru) {
+    free(nru->reference_bits);
+    free(nru);
+}
+
+void free_enhanced_clock_queue(EnhancedClockQueue* clock) {
+    free(clock->reference_bits);
+    free(clock);
+}
+
+void free_min_queue(MinQueue* min) {
+    free(min->heap);
+    free(min->position);
+    free(min->frame_next_use);
+    free(min);
+}
+
+void free_miss_curve(MissCurve* curve) {
+    free(curve->distance_counts);
+    free(curve);
+}
+
+void free_page_nodes(PageNodes* nodes) {
+    free(nodes->pages);
+    free(nodes->frames);
+    free(nodes->lists);
+    free(nodes->prev);
+    free(nodes->next);
+    free(nodes->frame_nodes);
+    free_page_index(nodes->index);
+    free(nodes);
+}
+
+void free_arc_queue(ArcQueue* arc) {
+    free_page_nodes(arc->nodes);
+    free(arc);
+}
+
+void free_twoq_queue(TwoQQueue* twoq) {
+    free_page_nodes(twoq->nodes);
+    free(twoq);
+}
+
+void free_lirs_queue(LirsQueue* lirs) {
+    free_page_nodes(lirs->nodes);
+    free(lirs->queue_prev);
+    free(lirs->queue_next);
+    free(lirs->queue_lists);
+    free(lirs->status);
+    free(lirs);
+}
+
+void free_clock_pro_queue(ClockProQueue* cp) {
+    free_page_nodes(cp->nodes);
+    free(cp->hot);
+    free(cp->reference_bits);
+    free(cp->test);
+    free(cp);
+}
+
+int fifo_replace(FIFOQueue* fifo) {
+    int replaced_index = fifo->next_index;
+    fifo->next_index = (fifo->next_index + 1) % fifo->size;
+    return replaced_index;
+}
+
+int lru_replace(LRUQueue* lru) {
+    return lru->tail;
+}
+
+// Move a frame to the head of the recency list, linking it first if it
+// has never been used (frames[frame] is still -1).
+void lru_touch(LRUQueue* lru, int frame) {
+    if (lru->head == frame) return;
+    if (lru->frames[frame] != -1) {
+        lru->next[lru->prev[frame]] = lru->next[frame];
+        if (lru->next[frame] != -1) {
+            lru->prev[lru->next[frame]] = lru->prev[frame];
+        } else {
+            lru->tail = lru->prev[frame];
+        }
+    }
+    lru->prev[frame] = -1;
+    lru->next[frame] = lru->head;
+    if (lru->head != -1) lru->prev[lru->head] = frame;
+    lru->head = frame;
+    if (lru->tail == -1) lru->tail = frame;
+}
+
+int clock_replace(ClockQueue* clock) {
+    while (1) {
+        if (clock->reference_bits[clock->hand] == 0) {
+            int replaced_index = clock->hand;
+            clock->hand = (clock->hand + 1) % clock->size;
+            return replaced_index;
+        } else {
+            clock->reference_bits[clock->hand] = 0;
+            clock->hand = (clock->hand + 1) % clock->size;
+        }
+    }
+}
+
+// Pops the victim off the head; the caller pushes the frame back with the
+// page it loads into it (second_chance_push).
+int second_chance_replace(SecondChanceQueue* sc) {
+    while (1) {
+        int frame = sc->queue[sc->head];
+        sc->head = (sc->head + 1) % sc->size;
+        sc->count--;
+        if (sc->reference_bits[frame] == 0) return frame;
+        sc->reference_bits[frame] = 0;
+        second_chance_push(sc, frame);
+    }
+}
+
+void second_chance_push(SecondChanceQueue* sc, int frame) {
+    sc->queue[(sc->head + sc->count) % sc->size] = frame;
+    sc->count++;
+}
+
+int nru_replace(NruQueue* nru) {
+    int victim = nru->hand;
+    int best = 4;
+    int frame = nru->hand;
+    for (int n = 0; n < nru->size; n++) {
+        int rank = 2 * nru->reference_bits[frame] + nru->dirty[frame];
+        if (rank < best) {
+            best = rank;
+            victim = frame;
+            if (rank == 0) break;
+        }
+        if (++frame == nru->size) frame = 0;
+    }
+    nru->hand = victim + 1 == nru->size ? 0 : victim + 1;
+    return victim;
+}
+
+// A frame whose bit is cleared in the second pass is not taken in the
+// same pass, so after one full sweep of both passes every bit is clear
+// and the next sweep is certain to find a victim.
+int enhanced_clock_replace(EnhancedClockQueue* clock) {
+    while (1) {
+        for (int n = 0; n < clock->size; n++) {
+            int frame = clock->hand;
+            clock->hand = (clock->hand + 1) % clock->size;
+            if (!clock->reference_bits[frame] && !clock->dirty[frame]) return frame;
+        }
+        for (int n = 0; n < clock->size; n++) {
+            int frame = clock->hand;
+            clock->hand = (clock->hand + 1) % clock->size;
+            if (clock->reference_bits[frame]) {
+                clock->reference_bits[frame] = 0;
+            } else if (clock->dirty[frame]) {
+                return frame;
+            }
+        }
+    }
+}
+
+static void min_swap(MinQueue* min, int a, int b) {
+    int frame_a = min->heap[a];
+    int frame_b = min->heap[b];
+    min->heap[a] = frame_b;
+    min->heap[b] = frame_a;
+    min->position[frame_b] = a;
+    min->position[frame_a] = b;
+}
+
+static void min_sift_up(MinQueue* min, int slot) {
+    while (slot > 0) {
+        int parent = (slot - 1) / 2;
+        if (min->frame_next_use[min->heap[parent]] >= min->frame_next_use[min->heap[slot]]) break;
+        min_swap(min, slot, parent);
+        slot = parent;
+    }
+}
+
+static void min_sift_down(MinQueue* min, int slot) {
+    while (1) {
+        int largest = slot;
+        int left = 2 * slot + 1;
+        int right = left + 1;
+        if (left < min->count && min->frame_next_use[min->heap[left]] > min->frame_next_use[min->heap[largest]]) largest = left;
+        if (right < min->count && min->frame_next_use[min->heap[right]] > min->frame_next_use[min->heap[largest]]) largest = right;
+        if (largest == slot) break;
+        min_swap(min, slot, largest);
+        slot = largest;
+    }
+}
+
+// The victim is the resident page whose next reference is farthest away.
+int min_replace(MinQueue* min) {
+    return min->heap[0];
+}
+
+// Re-key a frame after its page is referenced (or loaded) at trace index step.
+void min_update(MinQueue* min, int frame, int step) {
+    min->frame_next_use[frame] = min->next_use[step];
+    if (min->position[frame] == -1) {
+        min->heap[min->count] = frame;
+        min->position[frame] = min->count++;
+        min_sift_up(min, min->position[frame]);
+    } else {
+        min_sift_up(min, min->position[frame]);
+        min_sift_down(min, min->position[frame]);
+    }
+}
+
+EventLog* create_event_log(int level, const char* binary_path) {
+    EventLog* log = (EventLog*)calloc(1, sizeof(EventLog));
+    log->events = (AccessEvent*)malloc(EVENT_BUFFER_ENTRIES * sizeof(AccessEvent));
+    log->level = level;
+    if (binary_path) {
+        log->binary = fopen(binary_path, "wb");
+        if (!log->binary) {
+            free(log->events);
+            free(log);
+            return NULL;
+        }
+        // Header: magic and record size; records are native-endian AccessEvents.
+        unsigned char header[16] = {0};
+        memcpy(header, EVENT_FILE_MAGIC, sizeof(EVENT_FILE_MAGIC));
+        put_le32(header + 8, sizeof(AccessEvent));
+        fwrite(header, 1, sizeof(header), log->binary);
+    }
+    return log;
+}
+
+static inline void event_log_record(EventLog* log, int kind, long long step, uint64_t page_number, int frame_number) {
+    if (kind == EVENT_HIT && !log->binary && log->level < LOG_ACCESSES) return;
+    AccessEvent* event = &log->events[log->count++];
+    event->step = step;
+    event->page = page_number;
+    event->frame = frame_number;
+    event->kind = kind;
+    if (log->count == EVENT_BUFFER_ENTRIES) event_log_flush(log);
+}
+
+// Write out one batch: a single fwrite to the binary sink and the text
+// lines formatted into a local buffer, written in large blocks.
+void event_log_flush(EventLog* log) {
+    if (log->binary) fwrite(log->events, sizeof(AccessEvent), log->count, log->binary);
+    if (log->level > LOG_QUIET) {
+        char text[1 << 16];
+        size_t used = 0;
+        for (int i = 0; i < log->count; i++) {
+            AccessEvent* event = &log->events[i];
+            if (event->kind == EVENT_HIT && log->level < LOG_ACCESSES) continue;
+            if (used > sizeof(text) - 128) {
+                fwrite(text, 1, used, stdout);
+                used = 0;
+            }
+            const char* format = event->kind == EVENT_HIT ? "Step %lld - Hit: Page %llu found in frame %d\n"
+                               : event->kind == EVENT_MISS ? "Step %lld - Miss: Page %llu loaded into frame %d\n"
+                               : event->kind == EVENT_EVICT ? "Step %lld - Evict: Page %llu from frame %d\n"
+                               : event->kind == EVENT_WRITEBACK ? "Step %lld - Write-back: Page %llu from frame %d\n"
+                               : "Step %lld - Prefetch: Page %llu loaded into frame %d\n";
+            used += snprintf(text + used, sizeof(text) - used, format,
+                             (long long)event->step, (unsigned long long)event->page, event->frame);
+        }
+        fwrite(text, 1, used, stdout);
+    }
+    log->count = 0;
+}
+
+int close_event_log(EventLog* log) {
+    int status = 0;
+    event_log_flush(log);
+    if (log->binary && fclose(log->binary) != 0) status = -1;
+    free(log->events);
+    free(log);
+    return status;
+}
+
+static void init_tlb(Tlb* tlb, int entries, int ways) {
+    tlb->ways = ways;
+    tlb->sets = entries / ways;
+    tlb->tags = (uint64_t*)malloc(sizeof(uint64_t) * entries);
+    tlb->stamps = (uint64_t*)calloc(entries, sizeof(uint64_t));
+    for (int i = 0; i < entries; i++) tlb->tags[i] = PAGE_NONE;
+    tlb->clock = 0;
+}
+
+static void free_tlb(Tlb* tlb) {
+    free(tlb->tags);
+    free(tlb->stamps);
+}
+
+// Sets are picked by the low bits of the key, as hardware does with the
+// virtual page number.
+static inline int tlb_lookup(Tlb* tlb, uint64_t key) {
+    int base = (int)(key % (uint64_t)tlb->sets) * tlb->ways;
+    for (int way = base; way < base + tlb->ways; way++) {
+        if (tlb->tags[way] == key) {
+            tlb->stamps[way] = ++tlb->clock;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static inline void tlb_insert(Tlb* tlb, uint64_t key) {
+    int base = (int)(key % (uint64_t)tlb->sets) * tlb->ways;
+    int victim = base;
+    for (int way = base; way < base + tlb->ways; way++) {
+        if (tlb->tags[way] == PAGE_NONE) {
+            victim = way;
+            break;
+        }
+        if (tlb->stamps[way] < tlb->stamps[victim]) victim = way;
+    }
+    tlb->tags[victim] = key;
+    tlb->stamps[victim] = ++tlb->clock;
+}
+
+static inline void tlb_invalidate(Tlb* tlb, uint64_t key) {
+    int base = (int)(key % (uint64_t)tlb->sets) * tlb->ways;
+    for (int way = base; way < base + tlb->ways; way++) {
+        if (tlb->tags[way] == key) tlb->tags[way] = PAGE_NONE;
+    }
+}
+
+TranslationModel* create_translation_model(const TranslationConfig* config, int page_shift) {
+    TranslationModel* model = (TranslationModel*)calloc(1, sizeof(TranslationModel));
+    init_tlb(&model->l1, config->l1_entries, config->l1_ways);
+    init_tlb(&model->l2, config->l2_entries, config->l2_ways);
+    model->levels = config->levels;
+    model->leaf_level = 1 + (page_shift - MIN_PAGE_SHIFT) / PAGE_TABLE_INDEX_BITS;
+    if (model->leaf_level > model->levels) model->leaf_level = model->levels;
+    model->page_shift = page_shift;
+    for (int level = model->leaf_level; level <= model->levels; level++) {
+        if (level > model->leaf_level) init_tlb(&model->pwc[level], PWC_ENTRIES, PWC_ENTRIES);
+        model->nodes[level] = create_page_index(64);
+    }
+    return model;
+}
+
+void free_translation_model(TranslationModel* model) {
+    free_tlb(&model->l1);
+    free_tlb(&model->l2);
+    for (int level = model->leaf_level; level <= model->levels; level++) {
+        if (level > model->leaf_level) free_tlb(&model->pwc[level]);
+        free_page_index(model->nodes[level]);
+    }
+    free(model);
+}
+
+// The level-k table covering a page is named by the 4K page number above
+// the index bits of levels 1..k, tagged with the page's ASID.
+static inline uint64_t page_table_node(TranslationModel* model, uint64_t page, int level) {
+    uint64_t vpn = (page & PAGE_KEY_MASK) << (model->page_shift - MIN_PAGE_SHIFT);
+    return ((vpn & PAGE_KEY_MASK) >> (PAGE_TABLE_INDEX_BITS * level)) | (page & ~PAGE_KEY_MASK);
+}
+
+// Walk from the deepest table the page-walk cache can point to, reading one
+// entry per level down to the leaf, and fill the cache on the way down.
+static void translation_walk(TranslationModel* model, uint64_t page) {
+    int start = model->levels;
+    for (int level = model->leaf_level + 1; level <= model->levels; level++) {
+        if (tlb_lookup(&model->pwc[level], page_table_node(model, page, level - 1))) {
+            start = level - 1;
+            model->pwc_hits++;
+            break;
+        }
+    }
+    for (int level = start; level >= model->leaf_level; level--) {
+        uint64_t node = page_table_node(model, page, level);
+        if (page_index_lookup(model->nodes[level], node) == -1) page_index_insert(model->nodes[level], node, 0);
+        if (level > model->leaf_level) tlb_insert(&model->pwc[level], page_table_node(model, page, level - 1));
+    }
+    int references = start - model->leaf_level + 1;
+    model->walks++;
+    model->walk_references += references;
+    model->cycles += (long long)references * WALK_REFERENCE_CYCLES;
+}
+
+// Translate one reference: L1 TLB, then L2 TLB (refilling L1), then a
+// page walk that fills both.
+static inline void translation_access(TranslationModel* model, uint64_t page) {
+    model->accesses++;
+    model->cycles += TLB_L1_CYCLES;
+    if (tlb_lookup(&model->l1, page)) {
+        model->l1_hits++;
+        return;
+    }
+    model->cycles += TLB_L2_CYCLES;
+    if (tlb_lookup(&model->l2, page)) {
+        model->l2_hits++;
+        tlb_insert(&model->l1, page);
+        return;
+    }
+    translation_walk(model, page);
+    tlb_insert(&model->l2, page);
+    tlb_insert(&model->l1, page);
+}
+
+// An evicted page loses its translation: a TLB shootdown.
+static inline void translation_invalidate(TranslationModel* model, uint64_t page) {
+    tlb_invalidate(&model->l1, page);
+    tlb_invalidate(&model->l2, page);
+}
+
+void print_translation_statistics(TranslationModel* model) {
+    long long accesses = model->accesses > 0 ? model->accesses : 1;
+    long long l1_misses = model->accesses - model->l1_hits;
+    printf("TLB L1 hit ratio: %.2f%%\n", (double)model->l1_hits / accesses * 100);
+    printf("TLB L2 hit ratio: %.2f%% of L1 misses\n", l1_misses > 0 ? (double)model->l2_hits / l1_misses * 100 : 0.0);
+    printf("Page walks: %lld (%.2f per 1000 references), %lld table reads, page-walk cache hit ratio %.2f%%\n",
+           model->walks, (double)model->walks * 1000 / accesses, model->walk_references,
+           model->walks > 0 ? (double)model->pwc_hits / model->walks * 100 : 0.0);
+    long long tables = 0;
+    printf("Page-table pages:");
+    for (int level = model->levels; level >= model->leaf_level; level--) {
+        printf(" L%d %d%s", level, model->nodes[level]->count, level > model->leaf_level ? "," : "");
+        tables += model->nodes[level]->count;
+    }
+    printf(" (%lld KB)\n", tables * PAGE_SIZE / 1024);
+    printf("Translation cycles per access: %.2f\n", (double)model->cycles / accesses);
+}
+
+Prefetcher* create_prefetcher(const PrefetchConfig* config, int frames) {
+    Prefetcher* prefetcher = (Prefetcher*)calloc(1, sizeof(Prefetcher));
+    prefetcher->kind = config->kind;
+    // Loading more pages than half of memory per fault would evict the
+    // faulting page itself.
+    prefetcher->degree = config->degree < frames / 2 ? config->degree : frames / 2;
+    prefetcher->prefetched = (uint8_t*)calloc(frames, sizeof(uint8_t));
+    prefetcher->last_fault = PAGE_NONE;
+    if (prefetcher->kind == PREFETCH_MARKOV) {
+        size_t entries = (size_t)1 << MARKOV_ENTRIES_LOG;
+        prefetcher->tags = (uint64_t*)malloc(sizeof(uint64_t) * entries);
+        prefetcher->successors = (uint64_t*)malloc(sizeof(uint64_t) * entries * prefetcher->degree);
+        for (size_t i = 0; i < entries; i++) prefetcher->tags[i] = PAGE_NONE;
+    }
+    prefetcher->displaced = create_page_index(frames);
+    prefetcher->displaced_ring = (uint64_t*)malloc(sizeof(uint64_t) * frames);
+    for (int i = 0; i < frames; i++) prefetcher->displaced_ring[i] = PAGE_NONE;
+    prefetcher->displaced_size = frames;
+    return prefetcher;
+}
+
+void free_prefetcher(Prefetcher* prefetcher) {
+    free(prefetcher->prefetched);
+    free(prefetcher->tags);
+    free(prefetcher->successors);
+    free_page_index(prefetcher->displaced);
+    free(prefetcher->displaced_ring);
+    free(prefetcher);
+}
+
+static inline uint64_t page_step(uint64_t page, int64_t distance) {
+    return ((page + (uint64_t)distance) & PAGE_KEY_MASK) | (page & ~PAGE_KEY_MASK);
+}
+
+static inline uint64_t* markov_successors(Prefetcher* prefetcher, uint64_t page, int* slot) {
+    *slot = (int)((page * 0x9E3779B97F4A7C15ull) >> (64 - MARKOV_ENTRIES_LOG));
+    return &prefetcher->successors[(size_t)*slot * prefetcher->degree];
+}
+
+// Learns from one fault and fills candidates with the pages to prefetch.
+// A single frame clamps the degree to 0, leaving no successors to learn.
+static int prefetcher_observe(Prefetcher* prefetcher, uint64_t page) {
+    if (prefetcher->degree == 0) return 0;
+    uint64_t last = prefetcher->last_fault;
+    int same_space = last != PAGE_NONE && (last & ~PAGE_KEY_MASK) == (page & ~PAGE_KEY_MASK);
+    prefetcher->last_fault = page;
+    int count = 0;
+    switch (prefetcher->kind) {
+        case PREFETCH_SEQUENTIAL:
+            for (int k = 1; k <= prefetcher->degree; k++) prefetcher->candidates[count++] = page_step(page, k);
+            break;
+        case PREFETCH_STRIDE: {
+            int64_t stride = same_space ? (int64_t)((page - last) & PAGE_KEY_MASK) : 0;
+            if (stride >= (int64_t)(PAGE_KEY_MASK >> 1)) stride -= (int64_t)PAGE_KEY_MASK + 1;
+            if (stride != 0 && stride == prefetcher->stride) {
+                for (int k = 1; k <= prefetcher->degree; k++) prefetcher->candidates[count++] = page_step(page, stride * k);
+            }
+            prefetcher->stride = stride;
+            break;
+        }
+        case PREFETCH_MARKOV: {
+            int slot;
+            if (last != PAGE_NONE && last != page) {
+                uint64_t* next = markov_successors(prefetcher, last, &slot);
+                if (prefetcher->tags[slot] != last) {
+                    prefetcher->tags[slot] = last;
+                    for (int k = 0; k < prefetcher->degree; k++) next[k] = PAGE_NONE;
+                }
+                int k = 0;
+                while (k < prefetcher->degree - 1 && next[k] != page) k++;
+                for (; k > 0; k--) next[k] = next[k - 1];
+                next[0] = page;
+            }
+            uint64_t* next = markov_successors(prefetcher, page, &slot);
+            if (prefetcher->tags[slot] != page) break;
+            for (int k = 0; k < prefetcher->degree && next[k] != PAGE_NONE; k++) prefetcher->candidates[count++] = next[k];
+            break;
+        }
+    }
+    return count;
+}
+
+// A frame is leaving memory. An unused prefetch was wasted; a page pushed
+// out by a prefetch is remembered in case it faults again.
+static inline void prefetcher_evict(Prefetcher* prefetcher, int frame, uint64_t page, int prefetching) {
+    if (prefetcher->prefetched[frame]) {
+        prefetcher->prefetched[frame] = 0;
+        prefetcher->unused++;
+        return;
+    }
+    if (!prefetching) return;
+    int slot = prefetcher->displaced_next;
+    uint64_t old = prefetcher->displaced_ring[slot];
+    if (old != PAGE_NONE && page_index_lookup(prefetcher->displaced, old) == slot) {
+        page_index_remove(prefetcher->displaced, old);
+    }
+    prefetcher->displaced_ring[slot] = page;
+    page_index_insert(prefetcher->displaced, page, slot);
+    prefetcher->displaced_next = slot + 1 == prefetcher->displaced_size ? 0 : slot + 1;
+}
+
+static inline void prefetcher_demand_fault(Prefetcher* prefetcher, uint64_t page) {
+    if (prefetcher->displaced->count == 0 || page_index_lookup(prefetcher->displaced, page) == -1) return;
+    prefetcher->pollution++;
+    page_index_remove(prefetcher->displaced, page);
+}
+
+// Accuracy is the share of prefetched pages used before eviction and
+// coverage the share of would-be faults a prefetch saved.
+void print_prefetch_statistics(Prefetcher* prefetcher, PageTable* pt) {
+    long long would_fault = prefetcher->useful + pt->page_faults;
+    printf("Prefetched pages: %lld, used %lld, evicted unused %lld\n",
+           prefetcher->issued, prefetcher->useful, prefetcher->unused);
+    printf("Prefetch accuracy: %.2f%%\n", prefetcher->issued > 0 ? (double)prefetcher->useful / prefetcher->issued * 100 : 0.0);
+    printf("Prefetch coverage: %.2f%%\n", would_fault > 0 ? (double)prefetcher->useful / would_fault * 100 : 0.0);
+    printf("Prefetch pollution: %lld faults on pages a prefetch evicted (%.2f%% of faults)\n", prefetcher->pollution,
+           pt->page_faults > 0 ? (double)prefetcher->pollution / pt->page_faults * 100 : 0.0);
+}
+
+// Claims a frame for a page about to be loaded: the next free one while
+// memory fills, afterwards the policy's victim, which is unmapped and
+// written back if dirty.
+static inline __attribute__((always_inline)) int simulator_claim_frame(Simulator* sim, int i, int prefetching,
+        int (*choose_victim)(void*)) {
+    PageTable* pt = sim->pt;
+    PhysicalMemory* pm = sim->pm;
+    if (pm->next_frame < pm->size) return pm->next_frame++;
+
+    int frame_number = choose_victim(sim->state);
+    // The page table is indexed by frame, so the victim's state is at
+    // frame_number and pm->frames gives its page directly.
+    if (pt->valid[frame_number]) {
+        if (event_log) event_log_record(event_log, EVENT_EVICT, event_log->step_base + i, pm->frames[frame_number], frame_number);
+        if (pt->dirty[frame_number]) {
+            pt->write_backs++;
+            if (event_log) event_log_record(event_log, EVENT_WRITEBACK, event_log->step_base + i, pm->frames[frame_number], frame_number);
+        }
+        if (sim->translation) translation_invalidate(sim->translation, pm->frames[frame_number]);
+        if (sim->prefetcher) prefetcher_evict(sim->prefetcher, frame_number, pm->frames[frame_number], prefetching);
+        page_index_remove(pt->index, pm->frames[frame_number]);
+        pt->valid[frame_number] = 0;
+        if (pt->asid_evictions) pt->asid_evictions[pm->frames[frame_number] >> ASID_SHIFT]++;
+    }
+    return frame_number;
+}
+
+static inline __attribute__((always_inline)) void simulator_install(Simulator* sim, int frame_number, uint64_t page_number,
+        int referenced, int store, int i, void (*on_insert)(void*, int, uint64_t, int)) {
+    PageTable* pt = sim->pt;
+    pt->referenced[frame_number] = referenced;
+    pt->dirty[frame_number] = store;
+    pt->valid[frame_number] = 1;
+    sim->pm->frames[frame_number] = page_number;
+    page_index_insert(pt->index, page_number, frame_number);
+    on_insert(sim->state, frame_number, page_number, i);
+}
+
+// Loads the prefetcher's picks that are not resident, through the same
+// policy hooks as a demand fault but without counting a fault.
+static inline __attribute__((always_inline)) void simulator_prefetch(Simulator* sim, uint64_t page_number, int i,
+        void (*on_miss)(void*, uint64_t, int), int (*choose_victim)(void*),
+        void (*on_insert)(void*, int, uint64_t, int)) {
+    Prefetcher* prefetcher = sim->prefetcher;
+    int count = prefetcher_observe(prefetcher, page_number);
+    for (int k = 0; k < count; k++) {
+        uint64_t page = prefetcher->candidates[k];
+        if (page_index_lookup(sim->pt->index, page) != -1) continue;
+        on_miss(sim->state, page, i);
+        int frame_number = simulator_claim_frame(sim, i, 1, choose_victim);
+        if (event_log) event_log_record(event_log, EVENT_PREFETCH, event_log->step_base + i, page, frame_number);
+        simulator_install(sim, frame_number, page, 0, 0, i, on_insert);
+        prefetcher->prefetched[frame_number] = 1;
+        prefetcher->issued++;
+    }
+}
+
+// One reference, start to finish. Every loop goes through here: the
+// per-policy loops pass their hooks as constants, so after inlining they
+// are direct calls with no dispatch left in the loop; the single-step path
+// passes the policy's function pointers. Returns the frame that now holds
+// the page and sets *hit.
+static inline __attribute__((always_inline)) int simulator_access(Simulator* sim, TraceEntry* trace, int i, int* hit,
+        void (*on_hit)(void*, int, int), void (*on_miss)(void*, uint64_t, int),
+        int (*choose_victim)(void*), void (*on_insert)(void*, int, uint64_t, int)) {
+    PageTable* pt = sim->pt;
+    uint64_t page_number = trace_page(&trace[i], sim->page_shift);
+    int store = trace[i].operation == 's';
+    if (sim->translation) translation_access(sim->translation, page_number);
+
+    int frame_number = page_index_lookup(pt->index, page_number);
+    if (frame_number != -1) {
+        pt->referenced[frame_number] = 1;
+        pt->dirty[frame_number] |= store;
+        pt->hits++;
+        on_hit(sim->state, frame_number, i);
+        if (event_log) event_log_record(event_log, EVENT_HIT, event_log->step_base + i, page_number, frame_number);
+        if (sim->steps) {
+            sim->steps[i] = STEP_RECORD(frame_number, 1, sim->prefetcher && sim->prefetcher->prefetched[frame_number]);
+        }
+        *hit = 1;
+        // The first use of a prefetched page is the fault it saved, and
+        // the prefetcher hears of it as one to keep its stream going.
+        if (sim->prefetcher && sim->prefetcher->prefetched[frame_number]) {
+            sim->prefetcher->prefetched[frame_number] = 0;
+            sim->prefetcher->useful++;
+            simulator_prefetch(sim, page_number, i, on_miss, choose_victim, on_insert);
+        }
+        return frame_number;
+    }
+
+    pt->misses++;
+    pt->page_faults++;
+    if (store) pt->write_faults++;
+    else pt->read_faults++;
+    if (pt->asid_faults) pt->asid_faults[trace[i].asid]++;
+    if (sim->prefetcher) prefetcher_demand_fault(sim->prefetcher, page_number);
+    on_miss(sim->state, page_number, i);
+
+    frame_number = simulator_claim_frame(sim, i, 0, choose_victim);
+    if (event_log) event_log_record(event_log, EVENT_MISS, event_log->step_base + i, page_number, frame_number);
+    simulator_install(sim, frame_number, page_number, 1, store, i, on_insert);
+    if (sim->steps) sim->steps[i] = STEP_RECORD(frame_number, 0, 1);
+    *hit = 0;
+    if (sim->prefetcher) simulator_prefetch(sim, page_number, i, on_miss, choose_victim, on_insert);
+    return frame_number;
+}
+
+// Expands to <policy>_simulate, the policy's own copy of the loop. A new
+// policy defines <policy>_on_hit, _on_miss, _choose_victim and _on_insert,
+// invokes this macro and points its ReplacementPolicy::simulate at the result.
+#define DEFINE_SIMULATION_LOOP(policy)                                                      \
+    static void policy##_simulate(Simulator* sim, TraceEntry* trace, int trace_size) {     \
+        int hit;                                                                            \
+        for (int i = 0; i < trace_size; i++) {                                              \
+            simulator_access(sim, trace, i, &hit, policy##_on_hit, policy##_on_miss,        \
+                             policy##_choose_victim, policy##_on_insert);                   \
+        }                                                                                   \
+    }
+
+static void policy_ignore_hit(void* state, int frame, int step) {
+    (void)state; (void)frame; (void)step;
+}
+
+static void policy_ignore_miss(void* state, uint64_t page, int step) {
+    (void)state; (void)page; (void)step;
+}
+
+static inline void fifo_on_insert(void* state, int frame, uint64_t page, int step) {
+    FIFOQueue* fifo = (FIFOQueue*)state;
+    (void)page;
+    (void)step;
+    fifo->frames[frame] = frame;
+}
+
+static inline int fifo_choose_victim(void* state) {
+    return fifo_replace((FIFOQueue*)state);
+}
+
+#define fifo_on_hit policy_ignore_hit
+#define fifo_on_miss policy_ignore_miss
+DEFINE_SIMULATION_LOOP(fifo)
+
+static inline void lru_on_hit(void* state, int frame, int step) {
+    (void)step;
+    lru_touch((LRUQueue*)state, frame);
+}
+
+static inline int lru_choose_victim(void* state) {
+    return lru_replace((LRUQueue*)state);
+}
+
+static inline void lru_on_insert(void* state, int frame, uint64_t page, int step) {
+    LRUQueue* lru = (LRUQueue*)state;
+    (void)page;
+    (void)step;
+    lru_touch(lru, frame);
+    lru->frames[frame] = frame;
+}
+
+#define lru_on_miss policy_ignore_miss
+DEFINE_SIMULATION_LOOP(lru)
+
+static inline void min_on_hit(void* state, int frame, int step) {
+    min_update((MinQueue*)state, frame, step);
+}
+
+static inline int min_choose_victim(void* state) {
+    return min_replace((MinQueue*)state);
+}
+
+static inline void min_on_insert(void* state, int frame, uint64_t page, int step) {
+    (void)page;
+    min_update((MinQueue*)state, frame, step);
+}
+
+static void min_set_lookahead(void* state, long long* next_use) {
+    ((MinQueue*)state)->next_use = next_use;
+}
+
+#define min_on_miss policy_ignore_miss
+DEFINE_SIMULATION_LOOP(min)
+
+// The engine has already found the frame through the page index, so a
+// hit only has to set its reference bit.
+static inline void second_chance_on_hit(void* state, int frame, int step) {
+    (void)step;
+    ((SecondChanceQueue*)state)->reference_bits[frame] = 1;
+}
+
+static inline int second_chance_choose_victim(void* state) {
+    return second_chance_replace((SecondChanceQueue*)state);
+}
+
+static inline void second_chance_on_insert(void* state, int frame, uint64_t page, int step) {
+    SecondChanceQueue* sc = (SecondChanceQueue*)state;
+    (void)page;
+    (void)step;
+    // The faulting access itself sets the bit, as the MMU would.
+    sc->reference_bits[frame] = 1;
+    second_chance_push(sc, frame);
+}
+
+#define second_chance_on_miss policy_ignore_miss
+DEFINE_SIMULATION_LOOP(second_chance)
+
+static inline void clock_on_hit(void* state, int frame, int step) {
+    (void)step;
+    ((ClockQueue*)state)->reference_bits[frame] = 1;
+}
+
+static inline int clock_choose_victim(void* state) {
+    return clock_replace((ClockQueue*)state);
+}
+
+static inline void clock_on_insert(void* state, int frame, uint64_t page, int step) {
+    ClockQueue* clock = (ClockQueue*)state;
+    (void)page;
+    (void)step;
+    clock->frames[frame] = frame;
+    clock->reference_bits[frame] = 1;
+}
+
+#define clock_on_miss policy_ignore_miss
+DEFINE_SIMULATION_LOOP(clock)
+
+static inline void nru_tick(NruQueue* nru) {
+    if (++nru->references < NRU_TICK) return;
+    nru->references = 0;
+    memset(nru->reference_bits, 0, sizeof(int) * nru->size);
+}
+
+static inline void nru_on_hit(void* state, int frame, int step) {
+    NruQueue* nru = (NruQueue*)state;
+    (void)step;
+    nru->reference_bits[frame] = 1;
+    nru_tick(nru);
+}
+
+static inline void nru_on_miss(void* state, uint64_t page, int step) {
+    (void)page;
+    (void)step;
+    nru_tick((NruQueue*)state);
+}
+
+static inline int nru_choose_victim(void* state) {
+    return nru_replace((NruQueue*)state);
+}
+
+static inline void nru_on_insert(void* state, int frame, uint64_t page, int step) {
+    (void)page;
+    (void)step;
+    ((NruQueue*)state)->reference_bits[frame] = 1;
+}
+
+static void nru_set_dirty_bits(void* state, const uint8_t* dirty) {
+    ((NruQueue*)state)->dirty = dirty;
+}
+
+DEFINE_SIMULATION_LOOP(nru)
+
+static inline void enhanced_clock_on_hit(void* state, int frame, int step) {
+    (void)step;
+    ((EnhancedClockQueue*)state)->reference_bits[frame] = 1;
+}
+
+static inline int enhanced_clock_choose_victim(void* state) {
+    return enhanced_clock_replace((EnhancedClockQueue*)state);
+}
+
+static inline void enhanced_clock_on_insert(void* state, int frame, uint64_t page, int step) {
+    (void)page;
+    (void)step;
+    ((EnhancedClockQueue*)state)->reference_bits[frame] = 1;
+}
+
+static void enhanced_clock_set_dirty_bits(void* state, const uint8_t* dirty) {
+    ((EnhancedClockQueue*)state)->dirty = dirty;
+}
+
+#define enhanced_clock_on_miss policy_ignore_miss
+DEFINE_SIMULATION_LOOP(enhanced_clock)
+
+static void node_list_push_head(NodeList* list, int* prev, int* next, int node) {
+    prev[node] = -1;
+    next[node] = list->head;
+    if (list->head != -1) prev[list->head] = node;
+    list->head = node;
+    if (list->tail == -1) list->tail = node;
+    list->length++;
+}
+
+static void node_list_remove(NodeList* list, int* prev, int* next, int node) {
+    if (prev[node] != -1) next[prev[node]] = next[node];
+    else list->head = next[node];
+    if (next[node] != -1) prev[next[node]] = prev[node];
+    else list->tail = prev[node];
+    prev[node] = -1;
+    next[node] = -1;
+    list->length--;
+}
+
+int page_nodes_alloc(PageNodes* nodes, uint64_t page_number) {
+    int node = nodes->free_node;
+    nodes->free_node = nodes->next[node];
+    nodes->pages[node] = page_number;
+    nodes->frames[node] = -1;
+    nodes->lists[node] = -1;
+    nodes->prev[node] = -1;
+    nodes->next[node] = -1;
+    page_index_insert(nodes->index, page_number, node);
+    return node;
+}
+
+// The node must already be off every list.
+void page_nodes_release(PageNodes* nodes, int node) {
+    page_index_remove(nodes->index, nodes->pages[node]);
+    nodes->pages[node] = PAGE_NONE;
+    nodes->frames[node] = -1;
+    nodes->next[node] = nodes->free_node;
+    nodes->free_node = node;
+}
+
+// Doubles the node capacity; only called when no node is free.
+void page_nodes_grow(PageNodes* nodes) {
+    int old_capacity = nodes->capacity;
+    int capacity = 2 * old_capacity;
+    nodes->pages = (uint64_t*)realloc(nodes->pages, sizeof(uint64_t) * capacity);
+    nodes->frames = (int*)realloc(nodes->frames, sizeof(int) * capacity);
+    nodes->lists = (int*)realloc(nodes->lists, sizeof(int) * capacity);
+    nodes->prev = (int*)realloc(nodes->prev, sizeof(int) * capacity);
+    nodes->next = (int*)realloc(nodes->next, sizeof(int) * capacity);
+    for (int i = old_capacity; i < capacity; i++) {
+        nodes->pages[i] = PAGE_NONE;
+        nodes->frames[i] = -1;
+        nodes->lists[i] = -1;
+        nodes->prev[i] = -1;
+        nodes->next[i] = (i + 1 < capacity) ? i + 1 : -1;
+    }
+    nodes->free_node = old_capacity;
+    nodes->capacity = capacity;
+}
+
+static void page_nodes_unlist(PageNodes* nodes, NodeList* lists, int node) {
+    if (nodes->lists[node] == -1) return;
+    node_list_remove(&lists[nodes->lists[node]], nodes->prev, nodes->next, node);
+    nodes->lists[node] = -1;
+}
+
+// Move a node to the head of lists[list], from whichever list held it.
+static void page_nodes_move(PageNodes* nodes, NodeList* lists, int node, int list) {
+    page_nodes_unlist(nodes, lists, node);
+    node_list_push_head(&lists[list], nodes->prev, nodes->next, node);
+    nodes->lists[node] = list;
+}
+
+// Forget the page at the tail of a ghost list.
+static void page_nodes_drop_tail(PageNodes* nodes, NodeList* lists, int list) {
+    int node = lists[list].tail;
+    page_nodes_unlist(nodes, lists, node);
+    page_nodes_release(nodes, node);
+}
+
+// Make node the resident copy of its page in frame.
+static inline void page_nodes_place(PageNodes* nodes, int node, int frame) {
+    nodes->frames[node] = frame;
+    nodes->frame_nodes[frame] = node;
+}
+
+static inline void arc_on_hit(void* state, int frame, int step) {
+    ArcQueue* arc = (ArcQueue*)state;
+    (void)step;
+    page_nodes_move(arc->nodes, arc->lists, arc->nodes->frame_nodes[frame], ARC_T2);
+}
+
+// Adapt on a ghost hit; otherwise trim the ghost lists so the directory
+// stays within 2 * size pages once the new page is added.
+static inline void arc_on_miss(void* state, uint64_t page, int step) {
+    ArcQueue* arc = (ArcQueue*)state;
+    NodeList* lists = arc->lists;
+    (void)step;
+    arc->pending = page_index_lookup(arc->nodes->index, page);
+    arc->pending_list = -1;
+    arc->evict_t1 = 0;
+
+    if (arc->pending != -1) {
+        arc->pending_list = arc->nodes->lists[arc->pending];
+        if (arc->pending_list == ARC_B1) {
+            int delta = lists[ARC_B2].length / lists[ARC_B1].length;
+            arc->target += delta > 1 ? delta : 1;
+            if (arc->target > arc->size) arc->target = arc->size;
+        } else {
+            int delta = lists[ARC_B1].length / lists[ARC_B2].length;
+            arc->target -= delta > 1 ? delta : 1;
+            if (arc->target < 0) arc->target = 0;
+        }
+        page_nodes_unlist(arc->nodes, lists, arc->pending);
+        return;
+    }
+
+    int l1 = lists[ARC_T1].length + lists[ARC_B1].length;
+    int l2 = lists[ARC_T2].length + lists[ARC_B2].length;
+    if (l1 == arc->size) {
+        if (lists[ARC_T1].length < arc->size) page_nodes_drop_tail(arc->nodes, lists, ARC_B1);
+        else arc->evict_t1 = 1;
+    } else if (l1 + l2 == 2 * arc->size) {
+        page_nodes_drop_tail(arc->nodes, lists, ARC_B2);
+    }
+}
+
+static inline int arc_choose_victim(void* state) {
+    ArcQueue* arc = (ArcQueue*)state;
+    NodeList* lists = arc->lists;
+    PageNodes* nodes = arc->nodes;
+    int node;
+    int frame;
+
+    if (arc->evict_t1) {
+        // T1 alone fills memory and B1 is empty: drop its LRU page outright.
+        node = lists[ARC_T1].tail;
+        frame = nodes->frames[node];
+        page_nodes_unlist(nodes, lists, node);
+        page_nodes_release(nodes, node);
+        return frame;
+    }
+
+    int t1 = lists[ARC_T1].length;
+    if (t1 > 0 && (t1 > arc->target || (arc->pending_list == ARC_B2 && t1 == arc->target) || lists[ARC_T2].length == 0)) {
+        node = lists[ARC_T1].tail;
+        page_nodes_move(nodes, lists, node, ARC_B1);
+    } else {
+        node = lists[ARC_T2].tail;
+        page_nodes_move(nodes, lists, node, ARC_B2);
+    }
+    frame = nodes->frames[node];
+    nodes->frames[node] = -1;
+    return frame;
+}
+
+static inline void arc_on_insert(void* state, int frame, uint64_t page, int step) {
+    ArcQueue* arc = (ArcQueue*)state;
+    (void)step;
+    int node = arc->pending;
+    if (node != -1) {
+        page_nodes_move(arc->nodes, arc->lists, node, ARC_T2);
+    } else {
+        node = page_nodes_alloc(arc->nodes, page);
+        page_nodes_move(arc->nodes, arc->lists, node, ARC_T1);
+    }
+    page_nodes_place(arc->nodes, node, frame);
+}
+
+DEFINE_SIMULATION_LOOP(arc)
+
+// Hits in A1in are deliberately ignored: a burst of references to a new
+// page is still one use.
+static inline void twoq_on_hit(void* state, int frame, int step) {
+    TwoQQueue* twoq = (TwoQQueue*)state;
+    (void)step;
+    int node = twoq->nodes->frame_nodes[frame];
+    if (twoq->nodes->lists[node] == TWOQ_AM) page_nodes_move(twoq->nodes, twoq->lists, node, TWOQ_AM);
+}
+
+static inline void twoq_on_miss(void* state, uint64_t page, int step) {
+    TwoQQueue* twoq = (TwoQQueue*)state;
+    (void)step;
+    twoq->pending = page_index_lookup(twoq->nodes->index, page);
+    if (twoq->pending != -1) page_nodes_unlist(twoq->nodes, twoq->lists, twoq->pending);
+}
+
+static inline int twoq_choose_victim(void* state) {
+    TwoQQueue* twoq = (TwoQQueue*)state;
+    NodeList* lists = twoq->lists;
+    PageNodes* nodes = twoq->nodes;
+    int node;
+    int frame;
+    if (lists[TWOQ_A1IN].length > twoq->in_limit || lists[TWOQ_AM].length == 0) {
+        node = lists[TWOQ_A1IN].tail;
+        frame = nodes->frames[node];
+        nodes->frames[node] = -1;
+        page_nodes_move(nodes, lists, node, TWOQ_A1OUT);
+        if (lists[TWOQ_A1OUT].length > twoq->out_limit) page_nodes_drop_tail(nodes, lists, TWOQ_A1OUT);
+    } else {
+        node = lists[TWOQ_AM].tail;
+        frame = nodes->frames[node];
+        page_nodes_unlist(nodes, lists, node);
+        page_nodes_release(nodes, node);
+    }
+    return frame;
+}
+
+static inline void twoq_on_insert(void* state, int frame, uint64_t page, int step) {
+    TwoQQueue* twoq = (TwoQQueue*)state;
+    (void)step;
+    int node = twoq->pending;
+    if (node != -1) {
+        page_nodes_move(twoq->nodes, twoq->lists, node, TWOQ_AM);
+    } else {
+        node = page_nodes_alloc(twoq->nodes, page);
+        page_nodes_move(twoq->nodes, twoq->lists, node, TWOQ_A1IN);
+    }
+    page_nodes_place(twoq->nodes, node, frame);
+}
+
+DEFINE_SIMULATION_LOOP(twoq)
+
+// Q and the ghost list share the second set of links; a node is on at most one.
+static void lirs_queue_unlist(LirsQueue* lirs, int node) {
+    if (lirs->queue_lists[node] == -1) return;
+    node_list_remove(&lirs->queues[lirs->queue_lists[node]], lirs->queue_prev, lirs->queue_next, node);
+    lirs->queue_lists[node] = -1;
+}
+
+static void lirs_queue_move(LirsQueue* lirs, int node, int queue) {
+    lirs_queue_unlist(lirs, node);
+    node_list_push_head(&lirs->queues[queue], lirs->queue_prev, lirs->queue_next, node);
+    lirs->queue_lists[node] = queue;
+}
+
+static void lirs_stack_push(LirsQueue* lirs, int node) {
+    page_nodes_move(lirs->nodes, &lirs->stack, node, LIRS_STACK);
+}
+
+// Stack pruning: pop HIR pages off the bottom of S until a LIR page is
+// there. Resident ones stay in Q; non-resident ones are forgotten.
+static void lirs_prune(LirsQueue* lirs) {
+    while (lirs->stack.tail != -1 && lirs->status[lirs->stack.tail] != LIRS_LIR) {
+        int node = lirs->stack.tail;
+        page_nodes_unlist(lirs->nodes, &lirs->stack, node);
+        if (lirs->status[node] == LIRS_GHOST) {
+            lirs_queue_unlist(lirs, node);
+            page_nodes_release(lirs->nodes, node);
+        }
+    }
+}
+
+// Turn the LIR page at the bottom of S into a resident HIR page at the end of Q.
+static void lirs_demote_bottom(LirsQueue* lirs) {
+    int node = lirs->stack.tail;
+    page_nodes_unlist(lirs->nodes, &lirs->stack, node);
+    lirs->status[node] = LIRS_HIR;
+    lirs->lir_count--;
+    lirs_queue_move(lirs, node, LIRS_QUEUE);
+    lirs_prune(lirs);
+}
+
+static inline void lirs_on_hit(void* state, int frame, int step) {
+    LirsQueue* lirs = (LirsQueue*)state;
+    (void)step;
+    int node = lirs->nodes->frame_nodes[frame];
+    if (lirs->status[node] == LIRS_LIR) {
+        int was_bottom = (lirs->stack.tail == node);
+        lirs_stack_push(lirs, node);
+        if (was_bottom) lirs_prune(lirs);
+    } else if (lirs->nodes->lists[node] == LIRS_STACK) {
+        // Its reuse distance beats the oldest LIR page's: swap their roles.
+        lirs_stack_push(lirs, node);
+        lirs_queue_unlist(lirs, node);
+        lirs->status[node] = LIRS_LIR;
+        lirs->lir_count++;
+        lirs_demote_bottom(lirs);
+    } else {
+        lirs_stack_push(lirs, node);
+        lirs_queue_move(lirs, node, LIRS_QUEUE);
+    }
+}
+
+static inline void lirs_on_miss(void* state, uint64_t page, int step) {
+    LirsQueue* lirs = (LirsQueue*)state;
+    (void)step;
+    lirs->pending = page_index_lookup(lirs->nodes->index, page);
+    if (lirs->pending != -1) lirs_queue_unlist(lirs, lirs->pending);
+}
+
+// The victim is the resident HIR page at the front of Q. If it is still
+// on S it stays there as a ghost, so a quick re-reference can promote it.
+static inline int lirs_choose_victim(void* state) {
+    LirsQueue* lirs = (LirsQueue*)state;
+    PageNodes* nodes = lirs->nodes;
+    int node = lirs->queues[LIRS_QUEUE].tail;
+    int frame;
+
+    if (node == -1) {
+        // Single-frame memory has no HIR frames: drop the only LIR page.
+        node = lirs->stack.tail;
+        frame = nodes->frames[node];
+        page_nodes_unlist(nodes, &lirs->stack, node);
+        page_nodes_release(nodes, node);
+        lirs->lir_count--;
+        return frame;
+    }
+
+    lirs_queue_unlist(lirs, node);
+    frame = nodes->frames[node];
+    if (nodes->lists[node] == LIRS_STACK) {
+        nodes->frames[node] = -1;
+        lirs->status[node] = LIRS_GHOST;
+        lirs_queue_move(lirs, node, LIRS_GHOSTS);
+        if (lirs->queues[LIRS_GHOSTS].length > lirs->ghost_limit) {
+            int oldest = lirs->queues[LIRS_GHOSTS].tail;
+            lirs_queue_unlist(lirs, oldest);
+            page_nodes_unlist(nodes, &lirs->stack, oldest);
+            page_nodes_release(nodes, oldest);
+        }
+    } else {
+        page_nodes_release(nodes, node);
+    }
+    return frame;
+}
+
+static inline void lirs_on_insert(void* state, int frame, uint64_t page, int step) {
+    LirsQueue* lirs = (LirsQueue*)state;
+    (void)step;
+    int node = lirs->pending;
+    if (node == -1) {
+        node = page_nodes_alloc(lirs->nodes, page);
+        lirs_stack_push(lirs, node);
+        if (lirs->lir_count < lirs->lir_limit) {
+            lirs->status[node] = LIRS_LIR;
+            lirs->lir_count++;
+        } else {
+            lirs->status[node] = LIRS_HIR;
+            lirs_queue_move(lirs, node, LIRS_QUEUE);
+        }
+    } else {
+        // A ghost still on S: its reuse distance qualifies it as LIR.
+        lirs_stack_push(lirs, node);
+        lirs->status[node] = LIRS_LIR;
+        lirs->lir_count++;
+        if (lirs->lir_count > lirs->lir_limit) lirs_demote_bottom(lirs);
+    }
+    page_nodes_place(lirs->nodes, node, frame);
+    lirs_prune(lirs);
+}
+
+DEFINE_SIMULATION_LOOP(lirs)
+
+// New and promoted pages go in just behind HAND_hot, the head of the clock.
+static void clock_pro_link(ClockProQueue* cp, int node) {
+    int* prev = cp->nodes->prev;
+    int* next = cp->nodes->next;
+    if (cp->hand_hot == -1) {
+        prev[node] = node;
+        next[node] = node;
+        cp->hand_hot = cp->hand_cold = cp->hand_test = node;
+        return;
+    }
+    int tail = prev[cp->hand_hot];
+    prev[node] = tail;
+    next[node] = cp->hand_hot;
+    next[tail] = node;
+    prev[cp->hand_hot] = node;
+}
+
+static void clock_pro_unlink(ClockProQueue* cp, int node) {
+    int* prev = cp->nodes->prev;
+    int* next = cp->nodes->next;
+    int after = next[node];
+    if (after == node) {
+        cp->hand_hot = cp->hand_cold = cp->hand_test = -1;
+    } else {
+        if (cp->hand_hot == node) cp->hand_hot = after;
+        if (cp->hand_cold == node) cp->hand_cold = after;
+        if (cp->hand_test == node) cp->hand_test = after;
+        next[prev[node]] = after;
+        prev[after] = prev[node];
+    }
+    prev[node] = -1;
+    next[node] = -1;
+}
+
+// A cold page's test period ended without a re-reference. Returns 1 if it
+// was non-resident and has been forgotten.
+static int clock_pro_end_test(ClockProQueue* cp, int node) {
+    cp->test[node] = 0;
+    if (cp->cold_target > 1) cp->cold_target--;
+    if (cp->nodes->frames[node] != -1) return 0;
+    clock_pro_unlink(cp, node);
+    page_nodes_release(cp->nodes, node);
+    cp->nonresident_count--;
+    return 1;
+}
+
+// Run HAND_hot until one hot page with a clear reference bit is demoted.
+static void clock_pro_run_hand_hot(ClockProQueue* cp) {
+    while (1) {
+        int node = cp->hand_hot;
+        cp->hand_hot = cp->nodes->next[node];
+        if (cp->hot[node]) {
+            if (cp->reference_bits[node]) {
+                cp->reference_bits[node] = 0;
+            } else {
+                cp->hot[node] = 0;
+                cp->hot_count--;
+                return;
+            }
+        } else if (cp->test[node]) {
+            clock_pro_end_test(cp, node);
+        }
+    }
 }
 
-SecondChanceQueue* create_second_chance_queue(int size) {
-    SecondChanceQueue* sc = (SecondChanceQueue*)malloc(sizeof(SecondChanceQueue));
-    sc->pages = (int*)calloc(size, sizeof(int));
-    sc->frames = (int*)calloc(size, sizeof(int));
-    sc->reference_bits = (int*)calloc(size, sizeof(int));
-    for (int i = 0; i < size; i++) {
-        sc->pages[i] = -1;
-        sc->frames[i] = -1;
-        sc->reference_bits[i] = 0;
+// Run HAND_test until one non-resident page has been forgotten.
+static void clock_pro_run_hand_test(ClockProQueue* cp) {
+    while (1) {
+        int node = cp->hand_test;
+        cp->hand_test = cp->nodes->next[node];
+        if (!cp->hot[node] && cp->test[node] && clock_pro_end_test(cp, node)) return;
     }
-    sc->size = size;
-    sc->hand = 0;
-    return sc;
 }
 
-void free_page_table(PageTable* pt) {
-    free(pt->entries);
-    free(pt);
+static void clock_pro_balance(ClockProQueue* cp) {
+    while (cp->hot_count > cp->size - cp->cold_target) clock_pro_run_hand_hot(cp);
 }
 
-void free_physical_memory(PhysicalMemory* pm) {
-    free(pm->frames);
-    free(pm);
+static inline void clock_pro_on_hit(void* state, int frame, int step) {
+    ClockProQueue* cp = (ClockProQueue*)state;
+    (void)step;
+    cp->reference_bits[cp->nodes->frame_nodes[frame]] = 1;
 }
 
-void free_fifo_queue(FIFOQueue* fifo) {
-    free(fifo->pages);
-    free(fifo->frames);
-    free(fifo);
+// Only non-resident cold pages in their test period are still known here.
+// A re-reference means a larger cold allocation would have kept the page.
+static inline void clock_pro_on_miss(void* state, uint64_t page, int step) {
+    ClockProQueue* cp = (ClockProQueue*)state;
+    (void)step;
+    cp->pending = page_index_lookup(cp->nodes->index, page);
+    if (cp->pending == -1) return;
+    clock_pro_unlink(cp, cp->pending);
+    cp->nonresident_count--;
+    if (cp->cold_target < cp->size - 1) cp->cold_target++;
 }
 
-void free_lru_queue(LRUQueue* lru) {
-    free(lru->pages);
-    free(lru->frames);
-    free(lru->ages);
-    free(lru);
+static inline int clock_pro_choose_victim(void* state) {
+    ClockProQueue* cp = (ClockProQueue*)state;
+    PageNodes* nodes = cp->nodes;
+    cp->evicting = 1;
+    while (1) {
+        int node = cp->hand_cold;
+        cp->hand_cold = nodes->next[node];
+        if (cp->hot[node] || nodes->frames[node] == -1) continue;
+
+        if (cp->reference_bits[node]) {
+            // Referenced during its test period: promote. Otherwise start one.
+            cp->reference_bits[node] = 0;
+            clock_pro_unlink(cp, node);
+            clock_pro_link(cp, node);
+            if (cp->test[node]) {
+                cp->test[node] = 0;
+                cp->hot[node] = 1;
+                cp->hot_count++;
+                clock_pro_balance(cp);
+            } else {
+                cp->test[node] = 1;
+            }
+            continue;
+        }
+
+        int frame = nodes->frames[node];
+        nodes->frames[node] = -1;
+        if (cp->test[node]) {
+            cp->nonresident_count++;
+            if (cp->nonresident_count > cp->size) clock_pro_run_hand_test(cp);
+        } else {
+            clock_pro_unlink(cp, node);
+            page_nodes_release(nodes, node);
+        }
+        return frame;
+    }
 }
 
-void free_clock_queue(ClockQueue* clock) {
-    free(clock->pages);
-    free(clock->frames);
-    free(clock->reference_bits);
-    free(clock);
+// Until memory first fills, new pages are hot up to the hot allocation.
+static inline void clock_pro_on_insert(void* state, int frame, uint64_t page, int step) {
+    ClockProQueue* cp = (ClockProQueue*)state;
+    (void)step;
+    int node = cp->pending;
+    if (node == -1) {
+        node = page_nodes_alloc(cp->nodes, page);
+        cp->hot[node] = !cp->evicting && cp->hot_count < cp->size - cp->cold_target;
+        cp->test[node] = !cp->hot[node];
+    } else {
+        cp->hot[node] = 1;
+        cp->test[node] = 0;
+    }
+    cp->reference_bits[node] = 0;
+    page_nodes_place(cp->nodes, node, frame);
+    clock_pro_link(cp, node);
+    if (cp->hot[node]) {
+        cp->hot_count++;
+        clock_pro_balance(cp);
+    }
 }
 
-void free_second_chance_queue(SecondChanceQueue* sc) {
-    free(sc->pages);
-    free(sc->frames);
-    free(sc->reference_bits);
-    free(sc);
+DEFINE_SIMULATION_LOOP(clock_pro)
+
+static const ReplacementPolicy fifo_policy = {
+    (void* (*)(int))create_fifo_queue, (void (*)(void*))free_fifo_queue,
+    fifo_on_hit, fifo_on_miss, fifo_choose_victim, fifo_on_insert, NULL, NULL, fifo_simulate
+};
+
+static const ReplacementPolicy lru_policy = {
+    (void* (*)(int))create_lru_queue, (void (*)(void*))free_lru_queue,
+    lru_on_hit, lru_on_miss, lru_choose_victim, lru_on_insert, NULL, NULL, lru_simulate
+};
+
+static const ReplacementPolicy min_policy = {
+    (void* (*)(int))create_min_queue, (void (*)(void*))free_min_queue,
+    min_on_hit, min_on_miss, min_choose_victim, min_on_insert, min_set_lookahead, NULL, min_simulate
+};
+
+static const ReplacementPolicy second_chance_policy = {
+    (void* (*)(int))create_second_chance_queue, (void (*)(void*))free_second_chance_queue,
+    second_chance_on_hit, second_chance_on_miss, second_chance_choose_victim, second_chance_on_insert, NULL, NULL, second_chance_simulate
+};
+
+static const ReplacementPolicy clock_policy = {
+    (void* (*)(int))create_clock_queue, (void (*)(void*))free_clock_queue,
+    clock_on_hit, clock_on_miss, clock_choose_victim, clock_on_insert, NULL, NULL, clock_simulate
+};
+
+static const ReplacementPolicy arc_policy = {
+    (void* (*)(int))create_arc_queue, (void (*)(void*))free_arc_queue,
+    arc_on_hit, arc_on_miss, arc_choose_victim, arc_on_insert, NULL, NULL, arc_simulate
+};
+
+static const ReplacementPolicy twoq_policy = {
+    (void* (*)(int))create_twoq_queue, (void (*)(void*))free_twoq_queue,
+    twoq_on_hit, twoq_on_miss, twoq_choose_victim, twoq_on_insert, NULL, NULL, twoq_simulate
+};
+
+static const ReplacementPolicy lirs_policy = {
+    (void* (*)(int))create_lirs_queue, (void (*)(void*))free_lirs_queue,
+    lirs_on_hit, lirs_on_miss, lirs_choose_victim, lirs_on_insert, NULL, NULL, lirs_simulate
+};
+
+static const ReplacementPolicy clock_pro_policy = {
+    (void* (*)(int))create_clock_pro_queue, (void (*)(void*))free_clock_pro_queue,
+    clock_pro_on_hit, clock_pro_on_miss, clock_pro_choose_victim, clock_pro_on_insert, NULL, NULL, clock_pro_simulate
+};
+
+static const ReplacementPolicy nru_policy = {
+    (void* (*)(int))create_nru_queue, (void (*)(void*))free_nru_queue,
+    nru_on_hit, nru_on_miss, nru_choose_victim, nru_on_insert, NULL, nru_set_dirty_bits, nru_simulate
+};
+
+static const ReplacementPolicy enhanced_clock_policy = {
+    (void* (*)(int))create_enhanced_clock_queue, (void (*)(void*))free_enhanced_clock_queue,
+    enhanced_clock_on_hit, enhanced_clock_on_miss, enhanced_clock_choose_victim, enhanced_clock_on_insert, NULL,
+    enhanced_clock_set_dirty_bits, enhanced_clock_simulate
+};
+
+const ReplacementPolicy* const policies[NUM_ALGORITHMS] = {
+    &fifo_policy, &lru_policy, &min_policy, &second_chance_policy, &clock_policy,
+    &arc_policy, &twoq_policy, &lirs_policy, &clock_pro_policy, &nru_policy, &enhanced_clock_policy
+};
+
+Simulator* create_simulator(const ReplacementPolicy* policy, int frames, int page_shift) {
+    Simulator* sim = (Simulator*)malloc(sizeof(Simulator));
+    sim->pt = create_page_table(frames);
+    sim->pm = create_physical_memory(frames);
+    sim->page_shift = page_shift;
+    sim->policy = policy;
+    sim->state = policy->create(frames);
+    if (policy->set_dirty_bits) policy->set_dirty_bits(sim->state, sim->pt->dirty);
+    sim->translation = NULL;
+    sim->prefetcher = NULL;
+    sim->next_use = NULL;
+    sim->steps = NULL;
+    return sim;
 }
 
-int fifo_replace(FIFOQueue* fifo) {
-    int replaced_index = fifo->next_index;
-    fifo->next_index = (fifo->next_index + 1) % fifo->size;
-    return replaced_index;
+void simulator_enable_translation(Simulator* sim, const TranslationConfig* config) {
+    sim->translation = create_translation_model(config, sim->page_shift);
 }
 
-int lru_replace(LRUQueue* lru) {
-    int oldest_age = -1;
-    int replaced_index = 0;
-    for (int i = 0; i < lru->size; i++) {
-        if (lru->ages[i] > oldest_age) {
-            oldest_age = lru->ages[i];
-            replaced_index = i;
+void simulator_enable_prefetch(Simulator* sim, const PrefetchConfig* config) {
+    sim->prefetcher = create_prefetcher(config, sim->pm->size);
+}
+
+void free_simulator(Simulator* sim) {
+    if (sim->translation) free_translation_model(sim->translation);
+    if (sim->prefetcher) free_prefetcher(sim->prefetcher);
+    sim->policy->free(sim->state);
+    free_page_table(sim->pt);
+    free_physical_memory(sim->pm);
+    free(sim);
+}
+
+// The array stays owned by the caller; NULL detaches it again.
+void simulator_set_lookahead(Simulator* sim, long long* next_use) {
+    sim->next_use = next_use;
+    if (sim->policy->set_lookahead) sim->policy->set_lookahead(sim->state, next_use);
+}
+
+// Heat is the number of accesses since the frame's page was loaded. The
+// log does not see a prefetch, so a prefetched page counts as loaded at
+// its first use.
+static inline void step_heat(uint32_t* heat, uint32_t record) {
+    int frame = STEP_FRAME(record);
+    heat[frame] = STEP_LOADED(record) ? 1 : heat[frame] + 1;
+}
+
+// Replays the step log of a finished pass, saving heat and counters after
+// every interval steps.
+Checkpoints* create_checkpoints(const uint32_t* steps, int trace_size, int frames) {
+    Checkpoints* checkpoints = (Checkpoints*)malloc(sizeof(Checkpoints));
+    long long affordable = CHECKPOINT_BUDGET / ((long long)frames * sizeof(uint32_t));
+    long long wanted = (trace_size - 1) / CHECKPOINT_MIN_INTERVAL;
+    int count = (int)(affordable < wanted ? affordable : wanted);
+    if (count < 0) count = 0;
+    checkpoints->interval = (int)(((long long)trace_size + count) / (count + 1));
+    if (checkpoints->interval < CHECKPOINT_MIN_INTERVAL) checkpoints->interval = CHECKPOINT_MIN_INTERVAL;
+    checkpoints->frames = frames;
+    checkpoints->heat = (uint32_t*)malloc(sizeof(uint32_t) * (size_t)frames * count);
+    checkpoints->hits = (long long*)malloc(sizeof(long long) * count);
+    checkpoints->misses = (long long*)malloc(sizeof(long long) * count);
+
+    uint32_t* heat = (uint32_t*)calloc(frames, sizeof(uint32_t));
+    long long hits = 0;
+    int k = 0;
+    for (int step = 0; step < trace_size && k < count; step++) {
+        step_heat(heat, steps[step]);
+        hits += STEP_HIT(steps[step]);
+        if ((step + 1) % checkpoints->interval == 0) {
+            memcpy(checkpoints->heat + (size_t)k * frames, heat, sizeof(uint32_t) * frames);
+            checkpoints->hits[k] = hits;
+            checkpoints->misses[k] = step + 1 - hits;
+            k++;
         }
     }
-    return replaced_index;
+    checkpoints->count = k;
+    free(heat);
+    return checkpoints;
 }
 
-int clock_replace(ClockQueue* clock) {
+// Index of the latest checkpoint at or before step, or -1 when there is
+// none; *taken_at is set to its step, 0 without one.
+int checkpoints_find(Checkpoints* checkpoints, int step, int* taken_at) {
+    int k = step / checkpoints->interval;
+    if (k > checkpoints->count) k = checkpoints->count;
+    *taken_at = k * checkpoints->interval;
+    return k - 1;
+}
+
+void free_checkpoints(Checkpoints* checkpoints) {
+    free(checkpoints->heat);
+    free(checkpoints->hits);
+    free(checkpoints->misses);
+    free(checkpoints);
+}
+
+void simulate_virtual_memory(Simulator* sim, TraceEntry* trace, int trace_size) {
+    const ReplacementPolicy* policy = sim->policy;
+    if (policy->simulate) {
+        policy->simulate(sim, trace, trace_size);
+        return;
+    }
+    int hit;
+    for (int i = 0; i < trace_size; i++) {
+        simulator_access(sim, trace, i, &hit, policy->on_hit, policy->on_miss, policy->choose_victim, policy->on_insert);
+    }
+}
+
+int simulate_virtual_memory_step(Simulator* sim, TraceEntry* trace, int step, int* hit) {
+    const ReplacementPolicy* policy = sim->policy;
+    return simulator_access(sim, trace, step, hit, policy->on_hit, policy->on_miss, policy->choose_victim, policy->on_insert);
+}
+
+void simulate_trace_stream(Simulator* sim, TraceStream* stream) {
+    while (trace_stream_next(stream) > 0) {
+        // The stream owns the lookahead; the policy borrows it for this chunk.
+        simulator_set_lookahead(sim, stream->next_use);
+        if (event_log) event_log->step_base = stream->position;
+        simulate_virtual_memory(sim, stream->chunk, stream->chunk_size);
+    }
+    simulator_set_lookahead(sim, NULL);
+}
+
+double page_table_io_seconds(PageTable* pt) {
+    return (pt->read_faults * fault_latency.read + pt->write_faults * fault_latency.write
+            + pt->write_backs * fault_latency.write_back) / 1e6;
+}
+
+void print_statistics(PageTable* pt) {
+    long long total = pt->hits + pt->misses;
+    printf("Debug: Hits = %lld, Misses = %lld\n", pt->hits, pt->misses);
+    printf("Total references: %lld\n", total);
+    printf("Page faults: %lld\n", pt->page_faults);
+    printf("Hit ratio: %.2f%%\n", total > 0 ? (double)pt->hits / total * 100 : 0.0);
+    printf("Miss ratio: %.2f%%\n", total > 0 ? (double)pt->misses / total * 100 : 0.0);
+    printf("Read faults: %lld, write faults: %lld, dirty write-backs: %lld\n",
+           pt->read_faults, pt->write_faults, pt->write_backs);
+    printf("Estimated fault I/O time: %.3f s\n", page_table_io_seconds(pt));
+    if (pt->asid_count == 0) return;
+
+    // Evictions count the frames a process lost, whoever's fault took them.
+    printf("\n%5s %8s %-16s %12s %12s %12s\n", "ASID", "PID", "Command", "References", "Page faults", "Evicted");
+    for (int asid = 0; asid < pt->asid_count; asid++) {
+        ProcessInfo* process = &trace_processes[asid];
+        printf("%5d %8d %-16s %12lld %12lld %12lld\n", asid, (int)process->pid, process->command,
+               process->references, pt->asid_faults[asid], pt->asid_evictions[asid]);
+    }
+}
+
+static double elapsed_seconds(struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Each worker pulls jobs until the queue is empty and simulates them with
+// its own simulator over the shared trace.
+static void* comparison_worker(void* arg) {
+    ComparisonPool* pool = (ComparisonPool*)arg;
     while (1) {
-        if (clock->reference_bits[clock->hand] == 0) {
-            int replaced_index = clock->hand;
-            clock->hand = (clock->hand + 1) % clock->size;
-            return replaced_index;
-        } else {
-            clock->reference_bits[clock->hand] = 0;
-            clock->hand = (clock->hand + 1) % clock->size;
+        pthread_mutex_lock(&pool->lock);
+        int index = pool->next_job++;
+        pthread_mutex_unlock(&pool->lock);
+        if (index >= pool->job_count) break;
+
+        ComparisonJob* job = &pool->jobs[index];
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        Simulator* sim = create_simulator(policies[job->algorithm], job->frames, job->page_shift);
+        // The pool owns the next-use arrays; the policy only borrows one.
+        simulator_set_lookahead(sim, job->next_use);
+        if (pool->translation) simulator_enable_translation(sim, pool->translation);
+        // MIN runs without prefetching (see main).
+        if (pool->prefetch && !policies[job->algorithm]->set_lookahead) simulator_enable_prefetch(sim, pool->prefetch);
+
+        simulate_virtual_memory(sim, pool->trace, pool->trace_size);
+
+        job->hits = sim->pt->hits;
+        job->misses = sim->pt->misses;
+        job->page_faults = sim->pt->page_faults;
+        job->write_backs = sim->pt->write_backs;
+        job->io_seconds = page_table_io_seconds(sim->pt);
+        if (sim->translation) {
+            TranslationModel* model = sim->translation;
+            job->tlb_misses = model->accesses - model->l1_hits - model->l2_hits;
+            job->cycles_per_access = model->accesses > 0 ? (double)model->cycles / model->accesses : 0.0;
+        }
+        if (sim->prefetcher) {
+            Prefetcher* prefetcher = sim->prefetcher;
+            long long would_fault = prefetcher->useful + sim->pt->page_faults;
+            job->prefetching = 1;
+            job->prefetches = prefetcher->issued;
+            job->prefetch_accuracy = prefetcher->issued > 0 ? (double)prefetcher->useful / prefetcher->issued * 100 : 0.0;
+            job->prefetch_coverage = would_fault > 0 ? (double)prefetcher->useful / would_fault * 100 : 0.0;
         }
+        free_simulator(sim);
+        job->seconds = elapsed_seconds(&start);
     }
+    return NULL;
 }
 
-int second_chance_replace(SecondChanceQueue* sc) {
-    while (1) {
-        if (sc->reference_bits[sc->hand] == 0) {
-            int replaced_index = sc->hand;
-            sc->hand = (sc->hand + 1) % sc->size;
-            return replaced_index;
-        } else {
-            sc->reference_bits[sc->hand] = 0;
-            sc->hand = (sc->hand + 1) % sc->size;
+// Runs every algorithm under each (page size, frame count) configuration.
+// The raw trace is shared; only the next-use array depends on the page
+// size, so one is built per distinct page size.
+void run_comparison(TraceEntry* trace, int trace_size, int* page_shifts, int* frame_sizes, int config_count, int threads,
+                    const TranslationConfig* translation, const PrefetchConfig* prefetch) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    ComparisonPool pool;
+    pool.job_count = NUM_ALGORITHMS * config_count;
+    pool.jobs = (ComparisonJob*)calloc(pool.job_count, sizeof(ComparisonJob));
+    pool.next_job = 0;
+    pool.trace = trace;
+    pool.trace_size = trace_size;
+    pool.translation = translation;
+    pool.prefetch = prefetch;
+    pthread_mutex_init(&pool.lock, NULL);
+    long long** next_uses = (long long**)calloc(config_count, sizeof(long long*));
+    for (int c = 0; c < config_count; c++) {
+        for (int earlier = 0; earlier < c && !next_uses[c]; earlier++) {
+            if (page_shifts[earlier] == page_shifts[c]) next_uses[c] = next_uses[earlier];
+        }
+        if (!next_uses[c]) next_uses[c] = compute_next_use(trace, trace_size, page_shifts[c]);
+        for (int a = 0; a < NUM_ALGORITHMS; a++) {
+            ComparisonJob* job = &pool.jobs[c * NUM_ALGORITHMS + a];
+            job->algorithm = a;
+            job->frames = frame_sizes[c];
+            job->page_shift = page_shifts[c];
+            job->next_use = next_uses[c];
+        }
+    }
+
+    // The event log is a single shared sink; concurrent runs do not log.
+    EventLog* saved_log = event_log;
+    event_log = NULL;
+    if (threads > pool.job_count) threads = pool.job_count;
+    pthread_t* workers = (pthread_t*)malloc(sizeof(pthread_t) * threads);
+    for (int t = 0; t < threads; t++) pthread_create(&workers[t], NULL, comparison_worker, &pool);
+    for (int t = 0; t < threads; t++) pthread_join(workers[t], NULL);
+    free(workers);
+    event_log = saved_log;
+
+    printf("%-14s %9s %10s %14s %14s %14s %10s", "Algorithm", "Page size", "Frames", "Hits", "Misses", "Page faults", "Hit ratio");
+    printf(" %12s %10s", "Write-backs", "I/O (s)");
+    if (translation) printf(" %12s %9s", "TLB misses", "Cyc/ref");
+    if (prefetch) printf(" %12s %9s %9s", "Prefetched", "Accuracy", "Coverage");
+    printf(" %9s\n", "Time (s)");
+    for (int i = 0; i < pool.job_count; i++) {
+        ComparisonJob* job = &pool.jobs[i];
+        long long total = job->hits + job->misses;
+        int megabytes = job->page_shift >= 20;
+        printf("%-14s %8lu%c %10d %14lld %14lld %14lld %9.2f%%", algorithm_names[job->algorithm],
+               1UL << (job->page_shift - (megabytes ? 20 : 10)), megabytes ? 'M' : 'K', job->frames,
+               job->hits, job->misses, job->page_faults, total > 0 ? (double)job->hits / total * 100 : 0.0);
+        printf(" %12lld %10.3f", job->write_backs, job->io_seconds);
+        if (translation) printf(" %12lld %9.2f", job->tlb_misses, job->cycles_per_access);
+        if (job->prefetching) {
+            printf(" %12lld %8.2f%% %8.2f%%", job->prefetches, job->prefetch_accuracy, job->prefetch_coverage);
+        } else if (prefetch) {
+            printf(" %12s %9s %9s", "-", "-", "-");
         }
+        printf(" %9.3f\n", job->seconds);
+    }
+    printf("%d runs on %d threads in %.3f s\n", pool.job_count, threads, elapsed_seconds(&start));
+
+    pthread_mutex_destroy(&pool.lock);
+    for (int c = 0; c < config_count; c++) {
+        int shared = 0;
+        for (int earlier = 0; earlier < c; earlier++) shared |= (next_uses[earlier] == next_uses[c]);
+        if (!shared) free(next_uses[c]);
     }
+    free(next_uses);
+    free(pool.jobs);
 }
 
-int min_replace(TraceEntry* trace, int trace_size, int current_index, PageTable* pt, PhysicalMemory* pm) {
-    int farthest = current_index;
-    int replaced_index = -1;
+// Mattson LRU stack distances. A Fenwick tree over time slots holds a mark
+// at the latest reference of every page, so the distance of a re-use is one
+// plus the number of marks after the page's previous reference. When the
+// slots run out the live marks are renumbered from zero, so the tree only
+// ever needs about twice as many slots as there are distinct pages.
+MissCurve* lru_miss_curve(TraceStream* stream, int max_frames) {
+    MissCurve* curve = create_miss_curve(max_frames);
+    int capacity = TRACE_CHUNK_ENTRIES;
+    int* tree = (int*)calloc(capacity + 1, sizeof(int));
+    uint64_t* slot_page = (uint64_t*)calloc(capacity, sizeof(uint64_t));
+    PageIndex* last_slot = create_page_index(max_frames);
+    int now = 0;
+    int marks = 0;
 
-    for (int i = 0; i < pm->size; i++) {
-        int j;
-        for (j = current_index; j < trace_size; j++) {
-            if (pm->frames[i] == trace[j].address) {
-                if (j > farthest) {
-                    farthest = j;
-                    replaced_index = i;
+    while (trace_stream_next(stream) > 0) {
+        for (int i = 0; i < stream->chunk_size; i++) {
+            uint64_t page_number = trace_page(&stream->chunk[i], stream->page_shift);
+            if (now == capacity) {
+                int live = 0;
+                for (int slot = 0; slot < capacity; slot++) {
+                    if (page_index_lookup(last_slot, slot_page[slot]) != slot) continue;
+                    slot_page[live] = slot_page[slot];
+                    page_index_insert(last_slot, slot_page[slot], live);
+                    live++;
                 }
-                break;
+                if (2 * live > capacity) {
+                    capacity *= 2;
+                    tree = (int*)realloc(tree, (size_t)(capacity + 1) * sizeof(int));
+                    slot_page = (uint64_t*)realloc(slot_page, (size_t)capacity * sizeof(uint64_t));
+                }
+                for (int k = 1; k <= capacity; k++) {
+                    int covered = (k < live ? k : live) - (k - (k & -k));
+                    tree[k] = covered > 0 ? covered : 0;
+                }
+                now = live;
+            }
+
+            int last = page_index_lookup(last_slot, page_number);
+            if (last != -1) {
+                int upto_last = 0;
+                for (int k = last + 1; k > 0; k -= k & -k) upto_last += tree[k];
+                int distance = marks - upto_last + 1;
+                if (distance <= max_frames) curve->distance_counts[distance]++;
+                for (int k = last + 1; k <= capacity; k += k & -k) tree[k]--;
+                marks--;
+            }
+            for (int k = now + 1; k <= capacity; k += k & -k) tree[k]++;
+            marks++;
+            slot_page[now] = page_number;
+            page_index_insert(last_slot, page_number, now++);
+            curve->references++;
+        }
+    }
+
+    free(tree);
+    free(slot_page);
+    free_page_index(last_slot);
+    return curve;
+}
+
+static void load_tree_build(LoadTree* tree, int node, int left, int right, const int* values) {
+    tree->pending[node] = 0;
+    if (right - left == 1) {
+        tree->highest[node] = values[left];
+        return;
+    }
+    int middle = left + (right - left) / 2;
+    load_tree_build(tree, 2 * node, left, middle, values);
+    load_tree_build(tree, 2 * node + 1, middle, right, values);
+    int left_max = tree->highest[2 * node], right_max = tree->highest[2 * node + 1];
+    tree->highest[node] = left_max > right_max ? left_max : right_max;
+}
+
+static int load_tree_max(const LoadTree* tree, int node, int left, int right, int from, int to) {
+    if (from <= left && right <= to) return tree->highest[node];
+    int middle = left + (right - left) / 2;
+    int highest = INT_MIN;
+    if (from < middle) highest = load_tree_max(tree, 2 * node, left, middle, from, to);
+    if (to > middle) {
+        int right_max = load_tree_max(tree, 2 * node + 1, middle, right, from, to);
+        if (right_max > highest) highest = right_max;
+    }
+    return highest + tree->pending[node];
+}
+
+static void load_tree_add(LoadTree* tree, int node, int left, int right, int from, int to) {
+    if (from <= left && right <= to) {
+        tree->highest[node]++;
+        tree->pending[node]++;
+        return;
+    }
+    int middle = left + (right - left) / 2;
+    if (from < middle) load_tree_add(tree, 2 * node, left, middle, from, to);
+    if (to > middle) load_tree_add(tree, 2 * node + 1, middle, right, from, to);
+    int left_max = tree->highest[2 * node], right_max = tree->highest[2 * node + 1];
+    tree->highest[node] = (left_max > right_max ? left_max : right_max) + tree->pending[node];
+}
+
+static void load_tree_collect(const LoadTree* tree, int node, int left, int right, int carry, int* values) {
+    if (right - left == 1) {
+        values[left] = tree->highest[node] + carry;
+        return;
+    }
+    int middle = left + (right - left) / 2;
+    load_tree_collect(tree, 2 * node, left, middle, carry + tree->pending[node], values);
+    load_tree_collect(tree, 2 * node + 1, middle, right, carry + tree->pending[node], values);
+}
+
+// The reuses whose kept flag equals `which`, with the pieces renumbered so
+// that only the boundaries they use remain. A merged piece gets the highest
+// of its parts' values as its floor.
+static void reuse_set_half(const ReuseSet* set, const unsigned char* kept, int which, const int* values, ReuseSet* half) {
+    int* rank = (int*)malloc((size_t)(set->pieces + 1) * sizeof(int));
+    for (int k = 0; k <= set->pieces; k++) rank[k] = -1;
+    half->count = 0;
+    for (int i = 0; i < set->count; i++) {
+        if (kept[i] != which) continue;
+        rank[set->from[i]] = 0;
+        rank[set->to[i]] = 0;
+        half->count++;
+    }
+    half->from = (int*)malloc((size_t)half->count * sizeof(int));
+    half->to = (int*)malloc((size_t)half->count * sizeof(int));
+    half->floor = (int*)malloc((size_t)(set->pieces + 1) * sizeof(int));
+
+    int boundaries = 0;
+    int highest = INT_MIN;
+    for (int k = 0; k <= set->pieces; k++) {
+        if (rank[k] == 0) {
+            if (boundaries > 0) half->floor[boundaries - 1] = highest;
+            rank[k] = boundaries++;
+            highest = INT_MIN;
+        }
+        if (k < set->pieces && values[k] > highest) highest = values[k];
+    }
+    half->pieces = boundaries > 0 ? boundaries - 1 : 0;
+
+    int next = 0;
+    for (int i = 0; i < set->count; i++) {
+        if (kept[i] != which) continue;
+        half->from[next] = rank[set->from[i]];
+        half->to[next++] = rank[set->to[i]];
+    }
+    free(rank);
+}
+
+// Settles the distances of a reuse set known to lie in [low, high], where
+// high == max_frames + 1 stands for "more than max_frames". Frees the set.
+static void opt_curve_split(MissCurve* curve, ReuseSet* set, int low, int high) {
+    if (set->count == 0 || low == high) {
+        if (low <= curve->max_frames) curve->distance_counts[low] += set->count;
+        free(set->from);
+        free(set->to);
+        free(set->floor);
+        return;
+    }
+
+    int middle = low + (high - low) / 2;
+    LoadTree tree;
+    tree.highest = (int*)malloc((size_t)4 * set->pieces * sizeof(int));
+    tree.pending = (int*)malloc((size_t)4 * set->pieces * sizeof(int));
+    load_tree_build(&tree, 1, 0, set->pieces, set->floor);
+    unsigned char* kept = (unsigned char*)malloc((size_t)set->count);
+    for (int i = 0; i < set->count; i++) {
+        kept[i] = load_tree_max(&tree, 1, 0, set->pieces, set->from[i], set->to[i]) <= middle - 2;
+        if (kept[i]) load_tree_add(&tree, 1, 0, set->pieces, set->from[i], set->to[i]);
+    }
+    int* load = (int*)malloc((size_t)set->pieces * sizeof(int));
+    load_tree_collect(&tree, 1, 0, set->pieces, 0, load);
+    free(tree.highest);
+    free(tree.pending);
+
+    // Every larger memory keeps the reuses kept here, so the others see
+    // their load from the start.
+    ReuseSet smaller, larger;
+    reuse_set_half(set, kept, 1, set->floor, &smaller);
+    reuse_set_half(set, kept, 0, load, &larger);
+    free(kept);
+    free(load);
+    free(set->from);
+    free(set->to);
+    free(set->floor);
+    opt_curve_split(curve, &smaller, low, middle);
+    opt_curve_split(curve, &larger, middle + 1, high);
+}
+
+// OPT stack distances by divide and conquer over the memory size. A reuse
+// keeps its page resident over the references between its two uses, and
+// OPT at c frames hits exactly the reuses that a greedy pass in order of
+// their second use keeps while no reference has more than c - 1 pages held
+// across it. The set kept at c frames grows with c, so the distance of a
+// reuse is the smallest c that keeps it: each level runs the greedy at the
+// middle size over a load tree, sends the kept reuses to the smaller half
+// and the others, with the kept load as a floor, to the larger one. Each
+// reference costs O(log n log max_frames), but every reuse of the trace is
+// held in memory, and traces of INT_MAX references or more are refused.
+MissCurve* opt_miss_curve(TraceStream* stream, int max_frames) {
+    MissCurve* curve = create_miss_curve(max_frames);
+    PageIndex* last_use = create_page_index(max_frames);
+    ReuseSet reuses = {NULL, NULL, 0, NULL, 0};
+    int capacity = 0;
+
+    while (trace_stream_next(stream) > 0) {
+        for (int i = 0; i < stream->chunk_size; i++) {
+            if (curve->references == INT_MAX - 1) {
+                free(reuses.from);
+                free(reuses.to);
+                free_page_index(last_use);
+                free_miss_curve(curve);
+                return NULL;
+            }
+            int now = (int)curve->references++;
+            uint64_t page_number = trace_page(&stream->chunk[i], stream->page_shift);
+            int last = page_index_lookup(last_use, page_number);
+            page_index_insert(last_use, page_number, now);
+            if (last == -1) continue;
+            if (last == now - 1) {
+                curve->distance_counts[1]++;
+                continue;
+            }
+            if (reuses.count == capacity) {
+                capacity = capacity ? 2 * capacity : TRACE_CHUNK_ENTRIES;
+                reuses.from = (int*)realloc(reuses.from, (size_t)capacity * sizeof(int));
+                reuses.to = (int*)realloc(reuses.to, (size_t)capacity * sizeof(int));
             }
+            reuses.from[reuses.count] = last + 1;
+            reuses.to[reuses.count++] = now;
         }
-        if (j == trace_size) {
-            return i;
+    }
+    free_page_index(last_use);
+
+    // At the top every reference is its own piece.
+    reuses.pieces = (int)curve->references;
+    reuses.floor = (int*)calloc(reuses.pieces + 1, sizeof(int));
+    opt_curve_split(curve, &reuses, 2, max_frames + 1);
+    return curve;
+}
+
+void write_miss_curve(MissCurve* curve, FILE* out) {
+    long long hits = 0;
+    fprintf(out, "frames,hits,misses,miss_ratio\n");
+    for (int frames = 1; frames <= curve->max_frames; frames++) {
+        hits += curve->distance_counts[frames];
+        long long misses = curve->references - hits;
+        fprintf(out, "%d,%lld,%lld,%.6f\n", frames, hits, misses,
+                curve->references > 0 ? (double)misses / curve->references : 0.0);
+    }
+}
+
+// Working set (Denning): the resident set at reference t is W(t, tau), the
+// pages referenced in the last tau references, and a fault is a reference
+// outside it. PFF (Chu and Opderbeck): every fault adds its page, and a
+// fault more than tau references after the previous one first drops every
+// page not referenced since that previous fault. Resident pages sit on a
+// recency list with the time of their last reference, so the pages either
+// rule drops are always a tail of the list and each reference costs O(1)
+// amortized, with space for the resident set only.
+ResidentSetAllocator* create_resident_set_allocator(const AllocatorConfig* config, int frames) {
+    ResidentSetAllocator* allocator = (ResidentSetAllocator*)calloc(1, sizeof(ResidentSetAllocator));
+    allocator->kind = config->kind;
+    allocator->tau = config->tau;
+    allocator->frames = frames;
+    allocator->nodes = create_page_nodes(1024, 0);
+    allocator->last_use = (long long*)calloc(allocator->nodes->capacity, sizeof(long long));
+    node_list_init(&allocator->resident);
+    allocator->last_fault = -1;
+    allocator->thrashing_start = -1;
+    return allocator;
+}
+
+void free_resident_set_allocator(ResidentSetAllocator* allocator) {
+    free_page_nodes(allocator->nodes);
+    free(allocator->last_use);
+    free(allocator);
+}
+
+// Pops resident pages off the tail while their last use is before since.
+static void resident_set_trim(ResidentSetAllocator* allocator, long long since) {
+    NodeList* resident = &allocator->resident;
+    while (resident->tail != -1 && allocator->last_use[resident->tail] < since) {
+        int node = resident->tail;
+        node_list_remove(resident, allocator->nodes->prev, allocator->nodes->next, node);
+        page_nodes_release(allocator->nodes, node);
+    }
+}
+
+static void resident_set_end_thrashing(ResidentSetAllocator* allocator, long long end) {
+    long long length = end - allocator->thrashing_start;
+    printf("  references %lld-%lld: %lld faults (%.2f%%)\n", allocator->thrashing_start, end - 1,
+           allocator->thrashing_faults, (double)allocator->thrashing_faults / length * 100);
+    allocator->thrashing_start = -1;
+    allocator->thrashing_intervals++;
+}
+
+// Closes one sample interval: a row of the curve, and a thrashing interval
+// opened or closed by whether the mean resident set fit in memory.
+static void resident_set_sample(ResidentSetAllocator* allocator, FILE* curve) {
+    long long references = allocator->time - allocator->sample_start;
+    double mean = (double)allocator->sample_resident / references;
+    if (curve) {
+        fprintf(curve, "%lld,%.1f,%d,%lld,%.6f\n", allocator->time, mean, allocator->resident.length,
+                allocator->sample_faults, (double)allocator->sample_faults / references);
+    }
+    int thrashing = allocator->frames > 0 && mean > allocator->frames;
+    if (thrashing && allocator->thrashing_start == -1) {
+        allocator->thrashing_start = allocator->sample_start;
+        allocator->thrashing_faults = 0;
+    }
+    if (thrashing) allocator->thrashing_faults += allocator->sample_faults;
+    if (!thrashing && allocator->thrashing_start != -1) resident_set_end_thrashing(allocator, allocator->sample_start);
+    allocator->sample_start = allocator->time;
+    allocator->sample_faults = 0;
+    allocator->sample_resident = 0;
+}
+
+static inline void resident_set_access(ResidentSetAllocator* allocator, uint64_t page_number) {
+    PageNodes* nodes = allocator->nodes;
+    long long now = allocator->time;
+    int node = page_index_lookup(nodes->index, page_number);
+    if (node == -1) {
+        if (allocator->kind == ALLOCATOR_PFF && allocator->last_fault != -1 && now - allocator->last_fault > allocator->tau) {
+            resident_set_trim(allocator, allocator->last_fault);
+        }
+        allocator->last_fault = now;
+        allocator->faults++;
+        allocator->sample_faults++;
+        if (nodes->free_node == -1) {
+            page_nodes_grow(nodes);
+            allocator->last_use = (long long*)realloc(allocator->last_use, sizeof(long long) * nodes->capacity);
+        }
+        node = page_nodes_alloc(nodes, page_number);
+    } else {
+        node_list_remove(&allocator->resident, nodes->prev, nodes->next, node);
+    }
+    node_list_push_head(&allocator->resident, nodes->prev, nodes->next, node);
+    allocator->last_use[node] = now;
+    if (allocator->kind == ALLOCATOR_WORKING_SET) resident_set_trim(allocator, now - allocator->tau + 1);
+
+    int resident = allocator->resident.length;
+    allocator->resident_sum += resident;
+    allocator->sample_resident += resident;
+    if (resident > allocator->max_resident) allocator->max_resident = resident;
+    allocator->time++;
+}
+
+// Replays the stream under the allocator, writing one curve row per
+// RESIDENT_SAMPLE_REFERENCES references, and prints the summary.
+void run_resident_set_allocator(TraceStream* stream, const AllocatorConfig* config, int frames, FILE* curve) {
+    ResidentSetAllocator* allocator = create_resident_set_allocator(config, frames);
+    printf("%s allocation, tau = %lld references\n", config->kind == ALLOCATOR_PFF ? "Page-fault frequency" : "Working-set",
+           config->tau);
+    if (frames > 0) printf("Thrashing intervals (mean resident set over %d frames):\n", frames);
+    if (curve) fprintf(curve, "reference,mean_resident,resident,faults,fault_rate\n");
+    while (trace_stream_next(stream) > 0) {
+        for (int i = 0; i < stream->chunk_size; i++) {
+            resident_set_access(allocator, trace_page(&stream->chunk[i], stream->page_shift));
+            if (allocator->time - allocator->sample_start == RESIDENT_SAMPLE_REFERENCES) resident_set_sample(allocator, curve);
         }
     }
-    return (replaced_index == -1) ? 0 : replaced_index;
+    if (allocator->time > allocator->sample_start) resident_set_sample(allocator, curve);
+    if (allocator->thrashing_start != -1) resident_set_end_thrashing(allocator, allocator->time);
+    if (frames > 0 && allocator->thrashing_intervals == 0) printf("  none\n");
+
+    long long references = allocator->time > 0 ? allocator->time : 1;
+    double mean = (double)allocator->resident_sum / references;
+    printf("Total references: %lld\n", allocator->time);
+    printf("Page faults: %lld (%.2f%%)\n", allocator->faults, (double)allocator->faults / references * 100);
+    printf("Resident set: mean %.1f pages (%.1f MB), max %d pages\n", mean,
+           mean * ((double)(1ULL << stream->page_shift) / (1 << 20)), allocator->max_resident);
+    free_resident_set_allocator(allocator);
 }
 
-void simulate_virtual_memory(PageTable* pt, PhysicalMemory* pm, FIFOQueue* fifo, LRUQueue* lru, ClockQueue* clock, SecondChanceQueue* sc, int algorithm, TraceEntry* trace, int trace_size) {
+void visualize(TraceEntry* trace, int trace_size, int page_shift) {
+    FILE* plot_file = fopen("plot.txt", "w");
+    if (!plot_file) {
+        perror("Failed to open plot file");
+        return;
+    }
+
     for (int i = 0; i < trace_size; i++) {
-        int page_number = trace[i].address;
-        int frame_number = -1;
-
-        int found = 0;
-        for (int j = 0; j < pt->size; j++) {
-            if (pt->entries[j].valid && pt->entries[j].page_number == page_number) {
-                frame_number = pt->entries[j].frame_number;
-                pt->entries[j].referenced = 1;
-                found = 1;
-                pt->hits++;
-                printf("Hit: Page %d found in frame %d\n", page_number, frame_number);
-                break;
+        fprintf(plot_file, "%d %llu\n", i, (unsigned long long)(trace[i].address >> page_shift));
+    }
+
+    fclose(plot_file);
+
+    system("gnuplot -p -e \"set title 'Memory Access Trace'; set xlabel 'Time'; set ylabel 'Page Number'; plot 'plot.txt' with lines\"");
+}
+
+// The atlas is a grid of glyph cells, each as wide as the widest glyph
+// and as tall as the font, so a glyph's source rectangle follows from its
+// code alone.
+GlyphAtlas* create_glyph_atlas(SDL_Renderer* renderer, TTF_Font* font) {
+    GlyphAtlas* atlas = (GlyphAtlas*)calloc(1, sizeof(GlyphAtlas));
+    SDL_Color white = {255, 255, 255, 255};
+    SDL_Surface* glyphs[GLYPH_COUNT];
+    int cell_width = 1;
+    atlas->line_height = TTF_FontHeight(font);
+    for (int i = 0; i < GLYPH_COUNT; i++) {
+        glyphs[i] = TTF_RenderGlyph_Blended(font, (Uint16)(GLYPH_FIRST + i), white);
+        int advance = 0;
+        if (TTF_GlyphMetrics(font, (Uint16)(GLYPH_FIRST + i), NULL, NULL, NULL, NULL, &advance) != 0 && glyphs[i]) {
+            advance = glyphs[i]->w;
+        }
+        atlas->advance[i] = advance;
+        if (glyphs[i] && glyphs[i]->w > cell_width) cell_width = glyphs[i]->w;
+        if (glyphs[i] && glyphs[i]->h > atlas->line_height) atlas->line_height = glyphs[i]->h;
+    }
+
+    atlas->width = cell_width * GLYPH_ATLAS_COLUMNS;
+    atlas->height = atlas->line_height * ((GLYPH_COUNT + GLYPH_ATLAS_COLUMNS - 1) / GLYPH_ATLAS_COLUMNS);
+    SDL_Surface* sheet = SDL_CreateRGBSurfaceWithFormat(0, atlas->width, atlas->height, 32, SDL_PIXELFORMAT_RGBA32);
+    for (int i = 0; i < GLYPH_COUNT; i++) {
+        SDL_Rect cell = {(i % GLYPH_ATLAS_COLUMNS) * cell_width, (i / GLYPH_ATLAS_COLUMNS) * atlas->line_height, 0, 0};
+        if (glyphs[i]) {
+            cell.w = glyphs[i]->w;
+            cell.h = glyphs[i]->h;
+            if (sheet) {
+                // Copy the pixels as they are, alpha included.
+                SDL_SetSurfaceBlendMode(glyphs[i], SDL_BLENDMODE_NONE);
+                SDL_Rect target = cell;
+                SDL_BlitSurface(glyphs[i], NULL, sheet, &target);
             }
+            SDL_FreeSurface(glyphs[i]);
+        }
+        atlas->glyphs[i] = cell;
+    }
+    if (sheet) {
+        atlas->texture = SDL_CreateTextureFromSurface(renderer, sheet);
+        SDL_FreeSurface(sheet);
+    }
+    if (!atlas->texture) {
+        free(atlas);
+        return NULL;
+    }
+    SDL_SetTextureBlendMode(atlas->texture, SDL_BLENDMODE_BLEND);
+    return atlas;
+}
+
+void free_glyph_atlas(GlyphAtlas* atlas) {
+    SDL_DestroyTexture(atlas->texture);
+    free(atlas);
+}
+
+int text_width(GlyphAtlas* atlas, const char* text) {
+    int width = 0;
+    for (const unsigned char* c = (const unsigned char*)text; *c; c++) {
+        if (*c >= GLYPH_FIRST && *c <= GLYPH_LAST) width += atlas->advance[*c - GLYPH_FIRST];
+    }
+    return width;
+}
+
+// Queues the quads for one string; nothing reaches the renderer until
+// flush_text, which draws everything queued with a single call.
+void draw_text(GlyphAtlas* atlas, SDL_Renderer* renderer, int x, int y, const char* text, SDL_Color color) {
+    for (const unsigned char* c = (const unsigned char*)text; *c; c++) {
+        if (*c < GLYPH_FIRST || *c > GLYPH_LAST) continue;
+        int glyph = *c - GLYPH_FIRST;
+        SDL_Rect* source = &atlas->glyphs[glyph];
+        if (source->w > 0) {
+            if (atlas->quad_count == GLYPH_BATCH) flush_text(atlas, renderer);
+            float left = (float)x, top = (float)y;
+            float right = left + source->w, bottom = top + source->h;
+            float u0 = (float)source->x / atlas->width, v0 = (float)source->y / atlas->height;
+            float u1 = (float)(source->x + source->w) / atlas->width, v1 = (float)(source->y + source->h) / atlas->height;
+            SDL_Vertex* v = &atlas->vertices[atlas->quad_count * 4];
+            v[0] = (SDL_Vertex){{left, top}, color, {u0, v0}};
+            v[1] = (SDL_Vertex){{right, top}, color, {u1, v0}};
+            v[2] = (SDL_Vertex){{right, bottom}, color, {u1, v1}};
+            v[3] = (SDL_Vertex){{left, bottom}, color, {u0, v1}};
+            atlas->quad_count++;
+        }
+        x += atlas->advance[glyph];
+    }
+}
+
+void flush_text(GlyphAtlas* atlas, SDL_Renderer* renderer) {
+    if (atlas->quad_count == 0) return;
+    // Two triangles per quad; the index pattern is the same for every batch.
+    static int indices[GLYPH_BATCH * 6];
+    if (indices[1] == 0) {
+        for (int q = 0; q < GLYPH_BATCH; q++) {
+            int* index = &indices[q * 6];
+            index[0] = q * 4; index[1] = q * 4 + 1; index[2] = q * 4 + 2;
+            index[3] = q * 4; index[4] = q * 4 + 2; index[5] = q * 4 + 3;
+        }
+    }
+    SDL_RenderGeometry(renderer, atlas->texture, atlas->vertices, atlas->quad_count * 4, indices, atlas->quad_count * 6);
+    atlas->quad_count = 0;
+}
+
+Label create_label(SDL_Renderer* renderer, TTF_Font* font, const char* text) {
+    Label label = {NULL, 0, 0};
+    SDL_Color white = {255, 255, 255, 255};
+    SDL_Surface* surface = TTF_RenderText_Blended(font, text, white);
+    if (!surface) return label;
+    label.texture = SDL_CreateTextureFromSurface(renderer, surface);
+    label.w = surface->w;
+    label.h = surface->h;
+    SDL_FreeSurface(surface);
+    return label;
+}
+
+void draw_label(SDL_Renderer* renderer, Label* label, int x, int y) {
+    SDL_Rect target = {x, y, label->w, label->h};
+    if (label->texture) SDL_RenderCopy(renderer, label->texture, NULL, &target);
+}
+
+static const SDL_Color frame_class_colors[FRAME_CLASSES] = {
+    {128, 128, 128, 255}, {0, 100, 200, 255}, {0, 255, 0, 255}, {255, 0, 0, 255}
+};
+
+// Up to 100 frames keep the original ten-column layout of 80-pixel cells;
+// beyond that the grid is square and scaled so all of memory fits.
+FrameView* create_frame_view(SDL_Renderer* renderer, int frames) {
+    FrameView* view = (FrameView*)calloc(1, sizeof(FrameView));
+    view->frames = frames;
+    view->columns = 10;
+    if (frames > 100) {
+        while ((long long)view->columns * view->columns < frames) view->columns++;
+    }
+    view->rows = (frames + view->columns - 1) / view->columns;
+    double fit_x = (double)(FRAME_VIEW_WIDTH - 100) / view->columns;
+    double fit_y = (double)(FRAME_VIEW_HEIGHT - 20) / view->rows;
+    view->base_scale = fit_x < fit_y ? fit_x : fit_y;
+    if (view->base_scale > 80) view->base_scale = 80;
+    frame_view_reset(view);
+    view->highlight = -1;
+
+    if (view->columns <= HEATMAP_MAX_SIDE) {
+        view->heatmap = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                                          view->columns, view->rows);
+    }
+    if (view->heatmap) {
+        size_t pixels = (size_t)view->columns * view->rows;
+        view->pixels = (uint32_t*)malloc(sizeof(uint32_t) * pixels);
+        SDL_Color empty = frame_class_colors[FRAME_EMPTY];
+        uint32_t background = 0xFF000000u | ((uint32_t)empty.r << 16) | ((uint32_t)empty.g << 8) | empty.b;
+        for (size_t i = 0; i < pixels; i++) view->pixels[i] = i < (size_t)frames ? background : 0xFF000000u;
+        SDL_UpdateTexture(view->heatmap, NULL, view->pixels, view->columns * (int)sizeof(uint32_t));
+        view->touched = (int*)malloc(sizeof(int) * frames);
+        view->is_touched = (uint8_t*)calloc(frames, sizeof(uint8_t));
+    }
+    return view;
+}
+
+void free_frame_view(FrameView* view) {
+    for (int c = 0; c < FRAME_CLASSES; c++) free(view->cells[c]);
+    if (view->heatmap) SDL_DestroyTexture(view->heatmap);
+    free(view->pixels);
+    free(view->touched);
+    free(view->is_touched);
+    free(view);
+}
+
+void frame_view_reset(FrameView* view) {
+    view->zoom = 1.0;
+    view->pan_x = 50;
+    view->pan_y = 10;
+}
+
+// Zooms by factor keeping the point under (x, y) in place.
+void frame_view_zoom(FrameView* view, double factor, int x, int y) {
+    double scale = view->base_scale * view->zoom;
+    double zoom = view->zoom * factor;
+    if (zoom < 0.05) zoom = 0.05;
+    if (view->base_scale * zoom > 400) zoom = 400 / view->base_scale;
+    double new_scale = view->base_scale * zoom;
+    view->pan_x = (x - FRAME_VIEW_X) - (x - FRAME_VIEW_X - view->pan_x) / scale * new_scale;
+    view->pan_y = (y - FRAME_VIEW_Y) - (y - FRAME_VIEW_Y - view->pan_y) / scale * new_scale;
+    view->zoom = zoom;
+}
+
+void frame_view_pan(FrameView* view, int dx, int dy) {
+    view->pan_x += dx;
+    view->pan_y += dy;
+}
+
+static inline void frame_view_mark(FrameView* view, int frame) {
+    if (!view->heatmap || frame < 0 || view->is_touched[frame]) return;
+    view->is_touched[frame] = 1;
+    view->touched[view->touched_count++] = frame;
+}
+
+// Takes in a newly acquired snapshot: its changed frames, and the frames
+// gaining or losing the highlight, are queued for the heatmap.
+void frame_view_apply(FrameView* view, const SimulationSnapshot* snapshot) {
+    if (!view->heatmap) return;
+    if (snapshot->refresh) view->refresh = 1;
+    if (!view->refresh) {
+        for (int t = 0; t < snapshot->touched_count; t++) frame_view_mark(view, snapshot->touched[t]);
+        frame_view_mark(view, view->highlight);
+        frame_view_mark(view, snapshot->last_frame);
+    }
+    view->highlight = snapshot->last_frame;
+    view->highlight_hit = snapshot->last_hit;
+}
+
+static inline int frame_view_class(const SimulationSnapshot* snapshot, int frame) {
+    if (snapshot->heat[frame] == 0) return FRAME_EMPTY;
+    if (frame == snapshot->last_frame) return snapshot->last_hit ? FRAME_HIT : FRAME_MISS;
+    return FRAME_RESIDENT;
+}
+
+// Resident frames run from dark blue to white with the log of their
+// accesses since the page was loaded.
+static uint32_t frame_view_pixel(const SimulationSnapshot* snapshot, int frame) {
+    int frame_class = frame_view_class(snapshot, frame);
+    SDL_Color color = frame_class_colors[frame_class];
+    if (frame_class == FRAME_RESIDENT) {
+        int heat = 31 - __builtin_clz(snapshot->heat[frame]);
+        if (heat > 8) heat = 8;
+        color.r = (Uint8)(heat * 255 / 8);
+        color.g = (Uint8)(60 + heat * 195 / 8);
+        color.b = (Uint8)(140 + heat * 115 / 8);
+    }
+    return 0xFF000000u | ((uint32_t)color.r << 16) | ((uint32_t)color.g << 8) | color.b;
+}
+
+// Re-uploads the frames touched since the last draw, one pixel each, or
+// the whole texture when that is fewer calls.
+static void frame_view_update_heatmap(FrameView* view, const SimulationSnapshot* snapshot) {
+    int pitch = view->columns * (int)sizeof(uint32_t);
+    if (view->refresh) {
+        for (int frame = 0; frame < view->frames; frame++) view->pixels[frame] = frame_view_pixel(snapshot, frame);
+        SDL_UpdateTexture(view->heatmap, NULL, view->pixels, pitch);
+        for (int t = 0; t < view->touched_count; t++) view->is_touched[view->touched[t]] = 0;
+        view->touched_count = 0;
+        view->refresh = 0;
+        return;
+    }
+    int whole = view->touched_count > view->rows;
+    for (int t = 0; t < view->touched_count; t++) {
+        int frame = view->touched[t];
+        view->is_touched[frame] = 0;
+        view->pixels[frame] = frame_view_pixel(snapshot, frame);
+        if (!whole) {
+            SDL_Rect pixel = {frame % view->columns, frame / view->columns, 1, 1};
+            SDL_UpdateTexture(view->heatmap, &pixel, &view->pixels[frame], pitch);
         }
+    }
+    if (whole) SDL_UpdateTexture(view->heatmap, NULL, view->pixels, pitch);
+    view->touched_count = 0;
+}
 
-        if (!found) {
-            pt->misses++;
-            pt->page_faults++;
-            printf("Miss: Page %d not found\n", page_number);
+// The grid cell containing offset, rounding down, clamped so far-off
+// offsets stay in int range.
+static inline int grid_cell(double offset, double scale) {
+    double cell = offset / scale;
+    if (cell < -1) return -1;
+    if (cell > INT_MAX / 2) return INT_MAX / 2;
+    return (int)cell - (cell < 0 && cell != (int)cell);
+}
 
-            if (pm->next_frame < pm->size) {
-                frame_number = pm->next_frame++;
-            } else {
-                switch (algorithm) {
-                    case 0: frame_number = fifo_replace(fifo); break;
-                    case 1: frame_number = lru_replace(lru); break;
-                    case 2: frame_number = min_replace(trace, trace_size, i, pt, pm); break;
-                    case 3: frame_number = second_chance_replace(sc); break;
-                    case 4: frame_number = clock_replace(clock); break;
-                }
-                for (int j = 0; j < pt->size; j++) {
-                    if (pt->entries[j].valid && pt->entries[j].frame_number == frame_number) {
-                        pt->entries[j].valid = 0;
-                        break;
-                    }
-                }
-            }
+// Draws memory as of the snapshot into the view area, with the frame of
+// the latest access coloured by whether it hit.
+void frame_view_draw(FrameView* view, SDL_Renderer* renderer, GlyphAtlas* atlas, const SimulationSnapshot* snapshot) {
+    double scale = view->base_scale * view->zoom;
+    double origin_x = FRAME_VIEW_X + view->pan_x;
+    double origin_y = FRAME_VIEW_Y + view->pan_y;
+    SDL_Rect area = {FRAME_VIEW_X, FRAME_VIEW_Y, FRAME_VIEW_WIDTH, FRAME_VIEW_HEIGHT};
+    SDL_RenderSetClipRect(renderer, &area);
 
-            pt->entries[frame_number].page_number = page_number;
-            pt->entries[frame_number].frame_number = frame_number;
-            pt->entries[frame_number].referenced = 1;
-            pt->entries[frame_number].valid = 1;
-            pm->frames[frame_number] = page_number;
-
-
-            if (algorithm == 0) {
-                fifo->pages[frame_number] = page_number;
-                fifo->frames[frame_number] = frame_number;
-            } else if (algorithm == 1) {
-                lru->pages[frame_number] = page_number;
-                lru->frames[frame_number] = frame_number;
-                lru->ages[frame_number] = 0;
-                for (int j = 0; j < lru->size; j++) {
-                    if (lru->frames[j] != -1) lru->ages[j]++;
-                }
-            } else if (algorithm == 3) {
-                sc->pages[frame_number] = page_number;
-                sc->frames[frame_number] = frame_number;
-                sc->reference_bits[frame_number] = 1;
-            } else if (algorithm == 4) {
-                clock->pages[frame_number] = page_number;
-                clock->frames[frame_number] = frame_number;
-                clock->reference_bits[frame_number] = 1;
+    if (view->heatmap && (view->heatmap_only || scale < GRID_MIN_CELL)) {
+        frame_view_update_heatmap(view, snapshot);
+        SDL_Rect target = {(int)origin_x, (int)origin_y, (int)(view->columns * scale + 0.5), (int)(view->rows * scale + 0.5)};
+        SDL_RenderCopy(renderer, view->heatmap, NULL, &target);
+        SDL_RenderSetClipRect(renderer, NULL);
+        return;
+    }
+
+    // Only the cells that intersect the view area are visited.
+    int first_column = grid_cell(FRAME_VIEW_X - origin_x, scale);
+    int last_column = grid_cell(FRAME_VIEW_X + FRAME_VIEW_WIDTH - origin_x, scale);
+    int first_row = grid_cell(FRAME_VIEW_Y - origin_y, scale);
+    int last_row = grid_cell(FRAME_VIEW_Y + FRAME_VIEW_HEIGHT - origin_y, scale);
+    if (first_column < 0) first_column = 0;
+    if (first_row < 0) first_row = 0;
+    if (last_column >= view->columns) last_column = view->columns - 1;
+    if (last_row >= view->rows) last_row = view->rows - 1;
+    if (first_column > last_column || first_row > last_row) {
+        SDL_RenderSetClipRect(renderer, NULL);
+        return;
+    }
+
+    int visible = (last_column - first_column + 1) * (last_row - first_row + 1);
+    if (visible > view->cell_capacity) {
+        for (int c = 0; c < FRAME_CLASSES; c++) view->cells[c] = (SDL_Rect*)realloc(view->cells[c], sizeof(SDL_Rect) * visible);
+        view->cell_capacity = visible;
+    }
+    for (int c = 0; c < FRAME_CLASSES; c++) view->cell_counts[c] = 0;
+    // Boxes fill seven eighths of their cell, as the 70-pixel boxes on an
+    // 80-pixel pitch always did.
+    int size = (int)(scale * 7 / 8);
+    if (size < 1) size = 1;
+    for (int row = first_row; row <= last_row; row++) {
+        for (int column = first_column; column <= last_column; column++) {
+            int frame = row * view->columns + column;
+            if (frame >= view->frames) break;
+            int frame_class = frame_view_class(snapshot, frame);
+            SDL_Rect* cell = &view->cells[frame_class][view->cell_counts[frame_class]++];
+            cell->x = (int)(origin_x + column * scale);
+            cell->y = (int)(origin_y + row * scale);
+            cell->w = size;
+            cell->h = size;
+        }
+    }
+    for (int c = 0; c < FRAME_CLASSES; c++) {
+        if (view->cell_counts[c] == 0) continue;
+        SDL_Color color = frame_class_colors[c];
+        SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, 255);
+        SDL_RenderFillRects(renderer, view->cells[c], view->cell_counts[c]);
+    }
+    if (scale >= GRID_BORDER_CELL) {
+        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+        for (int c = 0; c < FRAME_CLASSES; c++) SDL_RenderDrawRects(renderer, view->cells[c], view->cell_counts[c]);
+    }
+    if (scale >= GRID_LABEL_CELL) {
+        SDL_Color white = {255, 255, 255, 255};
+        for (int row = first_row; row <= last_row; row++) {
+            for (int column = first_column; column <= last_column; column++) {
+                int frame = row * view->columns + column;
+                if (frame >= view->frames) break;
+                char label[16];
+                snprintf(label, sizeof(label), "F%d", frame);
+                draw_text(atlas, renderer, (int)(origin_x + column * scale) + 5, (int)(origin_y + row * scale) + 5, label, white);
             }
         }
+        // The labels must be clipped to the view area too.
+        flush_text(atlas, renderer);
     }
+    SDL_RenderSetClipRect(renderer, NULL);
 }
 
-void simulate_virtual_memory_step(PageTable* pt, PhysicalMemory* pm, FIFOQueue* fifo, LRUQueue* lru, ClockQueue* clock, SecondChanceQueue* sc, int algorithm, TraceEntry* trace, int step) {
-    int page_number = trace[step].address;
-    int frame_number = -1;
+static void simulation_snapshot_init(SimulationSnapshot* snapshot, int frames) {
+    memset(snapshot, 0, sizeof(SimulationSnapshot));
+    snapshot->last_frame = -1;
+    snapshot->heat = (uint32_t*)calloc(frames, sizeof(uint32_t));
+    snapshot->touched = (int*)malloc(sizeof(int) * SNAPSHOT_TOUCHED_MAX);
+}
 
-    int found = 0;
-    for (int j = 0; j < pt->size; j++) {
-        if (pt->entries[j].valid && pt->entries[j].page_number == page_number) {
-            frame_number = pt->entries[j].frame_number;
-            pt->entries[j].referenced = 1;
-            found = 1;
-            pt->hits++;
-            printf("Step %d - Hit: Page %d found in frame %d\n", step, page_number, frame_number);
-            break;
-        }
+static inline void simulation_worker_touch(SimulationWorker* worker, int frame) {
+    if (worker->is_touched[frame]) return;
+    if (worker->touched_count == SNAPSHOT_TOUCHED_MAX) {
+        worker->refresh = 1;
+        return;
     }
+    worker->is_touched[frame] = 1;
+    worker->touched[worker->touched_count++] = frame;
+}
 
-    if (!found) {
-        pt->misses++;
-        pt->page_faults++;
-        printf("Step %d - Miss: Page %d not found\n", step, page_number);
+// Fills the worker's buffer and makes it the latest snapshot, unless the
+// UI has yet to take the previous one.
+static int simulation_worker_publish(SimulationWorker* worker) {
+    if (__atomic_load_n(&worker->ready, __ATOMIC_ACQUIRE) & SNAPSHOT_FRESH) return 0;
+    SimulationSnapshot* snapshot = &worker->snapshots[worker->back];
+    snapshot->step = worker->step;
+    snapshot->hits = worker->hits;
+    snapshot->misses = worker->misses;
+    snapshot->last_frame = worker->last_frame;
+    snapshot->last_hit = worker->last_hit;
+    memcpy(snapshot->heat, worker->heat, sizeof(uint32_t) * worker->frames);
+    memcpy(snapshot->touched, worker->touched, sizeof(int) * worker->touched_count);
+    snapshot->touched_count = worker->touched_count;
+    snapshot->refresh = worker->refresh;
+    for (int t = 0; t < worker->touched_count; t++) worker->is_touched[worker->touched[t]] = 0;
+    worker->touched_count = 0;
+    worker->refresh = 0;
+    worker->back = __atomic_exchange_n(&worker->ready, worker->back | SNAPSHOT_FRESH, __ATOMIC_ACQ_REL);
+    return 1;
+}
 
-        if (pm->next_frame < pm->size) {
-            frame_number = pm->next_frame++;
-        } else {
-            switch (algorithm) {
-                case 0: frame_number = fifo_replace(fifo); break;
-                case 1: frame_number = lru_replace(lru); break;
-                case 2: frame_number = min_replace(trace, trace_size, step, pt, pm); break;
-                case 3: frame_number = second_chance_replace(sc); break;
-                case 4: frame_number = clock_replace(clock); break;
+// Replays the step log towards the UI's target step, in batches so a new
+// target is noticed quickly. A target behind the replay, or past a
+// checkpoint ahead of it, restarts it from the checkpoint at or before the
+// target, or from step 0 without checkpoints.
+static void* simulation_worker_main(void* arg) {
+    SimulationWorker* worker = (SimulationWorker*)arg;
+    Checkpoints* checkpoints = worker->checkpoints;
+    int frames = worker->frames;
+    while (!__atomic_load_n(&worker->quit, __ATOMIC_ACQUIRE)) {
+        int target = __atomic_load_n(&worker->target, __ATOMIC_ACQUIRE);
+        int taken_at = 0;
+        int k = checkpoints ? checkpoints_find(checkpoints, target, &taken_at) : -1;
+        if (target < worker->step || taken_at > worker->step) {
+            worker->step = taken_at;
+            if (k >= 0) {
+                memcpy(worker->heat, checkpoints->heat + (size_t)k * frames, sizeof(uint32_t) * frames);
+                worker->hits = checkpoints->hits[k];
+                worker->misses = checkpoints->misses[k];
+            } else {
+                memset(worker->heat, 0, sizeof(uint32_t) * frames);
+                worker->hits = 0;
+                worker->misses = 0;
             }
-            for (int j = 0; j < pt->size; j++) {
-                if (pt->entries[j].valid && pt->entries[j].frame_number == frame_number) {
-                    pt->entries[j].valid = 0;
-                    break;
-                }
+            // The step before the restart point is in the log, so the status
+            // bar keeps showing its result rather than a stale one.
+            if (worker->step > 0) {
+                worker->last_frame = STEP_FRAME(worker->steps[worker->step - 1]);
+                worker->last_hit = STEP_HIT(worker->steps[worker->step - 1]);
+            } else {
+                worker->last_frame = -1;
+                worker->last_hit = 0;
             }
+            worker->refresh = 1;
+            worker->pending = 1;
         }
-
-        pt->entries[frame_number].page_number = page_number;
-        pt->entries[frame_number].frame_number = frame_number;
-        pt->entries[frame_number].referenced = 1;
-        pt->entries[frame_number].valid = 1;
-        pm->frames[frame_number] = page_number;
-
-        if (algorithm == 0) {
-            fifo->pages[frame_number] = page_number;
-            fifo->frames[frame_number] = frame_number;
-        } else if (algorithm == 1) {
-            lru->pages[frame_number] = page_number;
-            lru->frames[frame_number] = frame_number;
-            lru->ages[frame_number] = 0;
-            for (int j = 0; j < lru->size; j++) {
-                if (lru->frames[j] != -1) lru->ages[j]++;
-            }
-        } else if (algorithm == 3) {
-            sc->pages[frame_number] = page_number;
-            sc->frames[frame_number] = frame_number;
-            sc->reference_bits[frame_number] = 1;
-        } else if (algorithm == 4) {
-            clock->pages[frame_number] = page_number;
-            clock->frames[frame_number] = frame_number;
-            clock->reference_bits[frame_number] = 1;
+        int end = target - worker->step > WORKER_BATCH ? worker->step + WORKER_BATCH : target;
+        for (; worker->step < end; worker->step++) {
+            uint32_t record = worker->steps[worker->step];
+            int frame = STEP_FRAME(record);
+            int hit = STEP_HIT(record);
+            step_heat(worker->heat, record);
+            if (hit) worker->hits++;
+            else worker->misses++;
+            worker->last_frame = frame;
+            worker->last_hit = hit;
+            simulation_worker_touch(worker, frame);
+            worker->pending = 1;
         }
+        if (worker->pending && simulation_worker_publish(worker)) worker->pending = 0;
+        if (worker->step == target) poll(NULL, 0, 1);
     }
+    return NULL;
 }
 
-void visualize(TraceEntry* trace, int trace_size) {
-    FILE* plot_file = fopen("plot.txt", "w");
-    if (!plot_file) {
-        perror("Failed to open plot file");
-        return;
+// steps and checkpoints stay the caller's and must outlive the worker.
+SimulationWorker* create_simulation_worker(const uint32_t* steps, int trace_size, int frames, Checkpoints* checkpoints) {
+    SimulationWorker* worker = (SimulationWorker*)calloc(1, sizeof(SimulationWorker));
+    worker->steps = steps;
+    worker->trace_size = trace_size;
+    worker->frames = frames;
+    worker->checkpoints = checkpoints;
+    for (int i = 0; i < 3; i++) simulation_snapshot_init(&worker->snapshots[i], frames);
+    worker->front = 0;
+    worker->ready = 1;
+    worker->back = 2;
+    worker->last_frame = -1;
+    worker->heat = (uint32_t*)calloc(frames, sizeof(uint32_t));
+    worker->touched = (int*)malloc(sizeof(int) * SNAPSHOT_TOUCHED_MAX);
+    worker->is_touched = (uint8_t*)calloc(frames, sizeof(uint8_t));
+    if (pthread_create(&worker->thread, NULL, simulation_worker_main, worker) != 0) {
+        perror("Failed to start the simulation thread");
+        exit(1);
     }
+    return worker;
+}
 
-    for (int i = 0; i < trace_size; i++) {
-        fprintf(plot_file, "%d %lu\n", i, trace[i].address);
+void free_simulation_worker(SimulationWorker* worker) {
+    __atomic_store_n(&worker->quit, 1, __ATOMIC_RELEASE);
+    pthread_join(worker->thread, NULL);
+    for (int i = 0; i < 3; i++) {
+        free(worker->snapshots[i].heat);
+        free(worker->snapshots[i].touched);
     }
+    free(worker->heat);
+    free(worker->touched);
+    free(worker->is_touched);
+    free(worker);
+}
 
-    fclose(plot_file);
+void simulation_worker_seek(SimulationWorker* worker, int step) {
+    if (step < 0) step = 0;
+    if (step > worker->trace_size) step = worker->trace_size;
+    __atomic_store_n(&worker->target, step, __ATOMIC_RELEASE);
+}
 
-    system("gnuplot -p -e \"set title 'Memory Access Trace'; set xlabel 'Time'; set ylabel 'Page Number'; plot 'plot.txt' with lines\"");
+// Returns the latest snapshot, which stays valid until the next call.
+// *fresh is set when it differs from the one returned last time.
+SimulationSnapshot* simulation_worker_acquire(SimulationWorker* worker, int* fresh) {
+    *fresh = 0;
+    if (__atomic_load_n(&worker->ready, __ATOMIC_ACQUIRE) & SNAPSHOT_FRESH) {
+        worker->front = __atomic_exchange_n(&worker->ready, worker->front, __ATOMIC_ACQ_REL) & ~SNAPSHOT_FRESH;
+        *fresh = 1;
+    }
+    return &worker->snapshots[worker->front];
 }
 
-void visualize_and_graph(TraceEntry* trace, int trace_size, PhysicalMemory* pm, PageTable* pt, PageTable* pt_graph, FIFOQueue* fifo, LRUQueue* lru, ClockQueue* clock, SecondChanceQueue* sc, int algorithm) {
-    visualize(trace, trace_size);
+// sim is the finished headless pass, shown as the bar chart; the animation
+// replays it from steps.
+void visualize_and_graph(TraceEntry* trace, int trace_size, Simulator* sim, const uint32_t* steps, Checkpoints* checkpoints) {
+    PageTable* pt_graph = sim->pt;
+    visualize(trace, trace_size, sim->page_shift);
     printf("Press Enter to continue to the graph visualization...\n");
     getchar();
 
@@ -596,7 +5436,7 @@ void visualize_and_graph(TraceEntry* trace, int trace_size, PhysicalMemory* pm,
         return;
     }
 
-    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
     if (!renderer) {
         fprintf(stderr, "Renderer could not be created! SDL_Error: %s\n", SDL_GetError());
         SDL_DestroyWindow(window);
@@ -615,18 +5455,54 @@ void visualize_and_graph(TraceEntry* trace, int trace_size, PhysicalMemory* pm,
         return;
     }
 
+    GlyphAtlas* atlas = create_glyph_atlas(renderer, font);
+    if (!atlas) {
+        fprintf(stderr, "Failed to build the glyph atlas! SDL_Error: %s\n", SDL_GetError());
+        TTF_CloseFont(font);
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+        TTF_Quit();
+        SDL_Quit();
+        return;
+    }
+    // Text that never changes is rendered once, up front.
+    enum { LABEL_TITLE, LABEL_HITS, LABEL_MISSES, LABEL_FAULTS, LABEL_INSTRUCTIONS, LABEL_FRAMES, LABEL_CONTROLS,
+           LABEL_VIEW_CONTROLS, LABEL_SEEK_CONTROLS, LABEL_COUNT };
+    const char* label_texts[LABEL_COUNT] = {
+        "Virtual Memory Performance", "Hits", "Misses", "Page Faults",
+        "Press SPACE to view animation (starts in auto mode)", "Physical Memory Frames",
+        "Controls: P = Toggle Auto/Manual, SPACE = Step in Manual",
+        "View: wheel or [ ] = Zoom, drag or arrows = Pan, 0 = Reset, H = Heatmap",
+        "Seek: click or drag the bar, Home/End = Start/End, PgUp/PgDn = Back/Forward 5%"
+    };
+    Label labels[LABEL_COUNT];
+    for (int i = 0; i < LABEL_COUNT; i++) labels[i] = create_label(renderer, font, label_texts[i]);
+    SDL_Color white = {255, 255, 255, 255};
+    FrameView* view = create_frame_view(renderer, sim->pm->size);
+    // The UI only asks for steps and draws the snapshots that come back.
+    SimulationWorker* worker = create_simulation_worker(steps, trace_size, sim->pm->size, checkpoints);
+    SDL_RendererInfo renderer_info;
+    int vsync = SDL_GetRendererInfo(renderer, &renderer_info) == 0 && (renderer_info.flags & SDL_RENDERER_PRESENTVSYNC);
+    SDL_Rect seek_bar = {50, 960, 900, 16};
+    int seek_jump = trace_size / 20 > 1 ? trace_size / 20 : 1;
+
     int quit = 0;
     SDL_Event e;
-    int step = 0;
     int show_graph = 1;
     int show_animation = 0;
     int auto_play = 0;
-    int animation_delay = 0.2;
-    int last_result=-1;
-    int last_accessed_frame = -1;
+    int fast_forward = 0;
+    double steps_per_second = 50;
+    double position = 0; // The step asked for; fractional while playing
+    int dragging = 0;
+    int seeking = 0;
+    Uint64 last_frame_time = SDL_GetPerformanceCounter();
 
     while (!quit) {
-        int advance_step = 0;
+        int fresh;
+        SimulationSnapshot* snapshot = simulation_worker_acquire(worker, &fresh);
+        if (fresh) frame_view_apply(view, snapshot);
+
         while (SDL_PollEvent(&e) != 0) {
             if (e.type == SDL_QUIT) {
                 quit = 1;
@@ -636,90 +5512,91 @@ void visualize_and_graph(TraceEntry* trace, int trace_size, PhysicalMemory* pm,
                         show_graph = 0;
                         show_animation = 1;
                         auto_play = 1;
-                    } else if (show_animation && !auto_play && step < trace_size) {
-                        int page_number = trace[step].address;
-                        int found = 0;
-                        last_accessed_frame = -1;
-
-                        for (int j = 0; j < pt->size; j++) {
-                            if (pt->entries[j].valid && pt->entries[j].page_number == page_number) {
-                                found = 1;
-                                last_accessed_frame = j;
-                                break;
-                            }
-                        }
-
-                        last_result = found ? 0 : 1;
-
-                        if (!found && pm->next_frame >= pm->size) {
-                            int frame_to_replace = -1;
-                            switch (algorithm) {
-                                case 0: frame_to_replace = fifo_replace(fifo); break;
-                                case 1: frame_to_replace = lru_replace(lru); break;
-                                case 2: frame_to_replace = min_replace(trace, trace_size, step, pt, pm); break;
-                                case 3: frame_to_replace = second_chance_replace(sc); break;
-                                case 4: frame_to_replace = clock_replace(clock); break;
-                            }
-                            last_accessed_frame = frame_to_replace;
-                        } else if (!found) {
-                            last_accessed_frame = pm->next_frame;
-                        }
-
-                        simulate_virtual_memory_step(pt, pm, fifo, lru, clock, sc, algorithm, trace, step);
-                        step++;
-                        advance_step = 1;
+                        if (position >= trace_size) position = 0;
+                    } else if (show_animation && !auto_play && position < trace_size) {
+                        position = (int)position + 1;
                     }
                 } else if (e.key.keysym.sym == SDLK_ESCAPE) {
                     quit = 1;
                 } else if (e.key.keysym.sym == SDLK_p && show_animation) {
                     auto_play = !auto_play;
+                    // Pausing stops where the display is, not where a
+                    // fast-forward was heading.
+                    if (!auto_play) position = snapshot->step;
+                } else if (e.key.keysym.sym == SDLK_f && show_animation) {
+                    fast_forward = !fast_forward;
+                    if (!fast_forward) position = snapshot->step;
                 } else if (e.key.keysym.sym == SDLK_PLUS || e.key.keysym.sym == SDLK_EQUALS) {
-                    animation_delay = (animation_delay > 1) ? animation_delay - 1 : 0;
+                    steps_per_second = steps_per_second < 1e7 ? steps_per_second * 2 : 1e7;
                 } else if (e.key.keysym.sym == SDLK_MINUS) {
-                    animation_delay = (animation_delay < 100) ? animation_delay + 5 : 100;
+                    steps_per_second = steps_per_second > 1 ? steps_per_second / 2 : 1;
+                } else if (e.key.keysym.sym == SDLK_HOME) {
+                    position = 0;
+                } else if (e.key.keysym.sym == SDLK_END) {
+                    position = trace_size;
+                } else if (e.key.keysym.sym == SDLK_PAGEUP) {
+                    position = position > seek_jump ? (int)position - seek_jump : 0;
+                } else if (e.key.keysym.sym == SDLK_PAGEDOWN) {
+                    position = position + seek_jump < trace_size ? (int)position + seek_jump : trace_size;
+                } else if (e.key.keysym.sym == SDLK_LEFT) {
+                    frame_view_pan(view, 100, 0);
+                } else if (e.key.keysym.sym == SDLK_RIGHT) {
+                    frame_view_pan(view, -100, 0);
+                } else if (e.key.keysym.sym == SDLK_UP) {
+                    frame_view_pan(view, 0, 100);
+                } else if (e.key.keysym.sym == SDLK_DOWN) {
+                    frame_view_pan(view, 0, -100);
+                } else if (e.key.keysym.sym == SDLK_RIGHTBRACKET) {
+                    frame_view_zoom(view, 1.25, FRAME_VIEW_X + FRAME_VIEW_WIDTH / 2, FRAME_VIEW_Y + FRAME_VIEW_HEIGHT / 2);
+                } else if (e.key.keysym.sym == SDLK_LEFTBRACKET) {
+                    frame_view_zoom(view, 0.8, FRAME_VIEW_X + FRAME_VIEW_WIDTH / 2, FRAME_VIEW_Y + FRAME_VIEW_HEIGHT / 2);
+                } else if (e.key.keysym.sym == SDLK_0) {
+                    frame_view_reset(view);
+                } else if (e.key.keysym.sym == SDLK_h) {
+                    view->heatmap_only = !view->heatmap_only;
                 }
-            }
-        }
-
-        if (show_animation && auto_play && step < trace_size) {
-            int page_number = trace[step].address;
-            int found = 0;
-            last_accessed_frame = -1;
-
-            for (int j = 0; j < pt->size; j++) {
-                if (pt->entries[j].valid && pt->entries[j].page_number == page_number) {
-                    found = 1;
-                    last_accessed_frame = j;
-                    break;
+            } else if (e.type == SDL_MOUSEWHEEL && show_animation) {
+                int x, y;
+                SDL_GetMouseState(&x, &y);
+                frame_view_zoom(view, e.wheel.y > 0 ? 1.25 : 0.8, x, y);
+            } else if (e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_LEFT && show_animation) {
+                SDL_Point point = {e.button.x, e.button.y};
+                if (SDL_PointInRect(&point, &seek_bar)) {
+                    seeking = 1;
+                    position = (double)(e.button.x - seek_bar.x) / seek_bar.w * trace_size;
+                } else {
+                    dragging = 1;
                 }
-            }
-
-            last_result = found ? 0 : 1;
-
-            if (!found && pm->next_frame >= pm->size) {
-                int frame_to_replace = -1;
-                switch (algorithm) {
-                    case 0: frame_to_replace = fifo_replace(fifo); break;
-                    case 1: frame_to_replace = lru_replace(lru); break;
-                    case 2: frame_to_replace = min_replace(trace, trace_size, step, pt, pm); break;
-                    case 3: frame_to_replace = second_chance_replace(sc); break;
-                    case 4: frame_to_replace = clock_replace(clock); break;
+            } else if (e.type == SDL_MOUSEBUTTONUP && e.button.button == SDL_BUTTON_LEFT) {
+                dragging = 0;
+                seeking = 0;
+            } else if (e.type == SDL_MOUSEMOTION && show_animation) {
+                if (seeking) {
+                    int x = e.motion.x < seek_bar.x ? seek_bar.x : (e.motion.x > seek_bar.x + seek_bar.w ? seek_bar.x + seek_bar.w : e.motion.x);
+                    position = (double)(x - seek_bar.x) / seek_bar.w * trace_size;
+                } else if (dragging) {
+                    frame_view_pan(view, e.motion.xrel, e.motion.yrel);
                 }
-                last_accessed_frame = frame_to_replace;
-            } else if (!found) {
-                last_accessed_frame = pm->next_frame;
             }
+        }
 
-            simulate_virtual_memory_step(pt, pm, fifo, lru, clock, sc, algorithm, trace, step);
-            step++;
-            advance_step = 1;
+        // Playback advances with the clock rather than once per frame, so
+        // any speed can be kept up at any frame rate.
+        Uint64 now = SDL_GetPerformanceCounter();
+        double elapsed = (double)(now - last_frame_time) / SDL_GetPerformanceFrequency();
+        last_frame_time = now;
+        if (show_animation && auto_play && !seeking) {
+            position = fast_forward ? trace_size : position + steps_per_second * elapsed;
+            if (position > trace_size) position = trace_size;
         }
+        simulation_worker_seek(worker, (int)position);
+        int step = snapshot->step;
 
         SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
         SDL_RenderClear(renderer);
 
         if (show_graph) {
-            int total = pt_graph->hits + pt_graph->misses;
+            long long total = pt_graph->hits + pt_graph->misses;
             float hit_ratio = total > 0 ? (float)pt_graph->hits / total : 0;
             float miss_ratio = total > 0 ? (float)pt_graph->misses / total : 0;
             float fault_ratio = total > 0 ? (float)pt_graph->page_faults / total : 0;
@@ -750,22 +5627,10 @@ void visualize_and_graph(TraceEntry* trace, int trace_size, PhysicalMemory* pm,
 
                 char percent_text[10];
                 snprintf(percent_text, sizeof(percent_text), "%d%%", i);
-                SDL_Color white = {255, 255, 255, 255};
-                SDL_Surface* percentSurface = TTF_RenderText_Solid(font, percent_text, white);
-                SDL_Texture* percentTexture = SDL_CreateTextureFromSurface(renderer, percentSurface);
-                SDL_Rect percentRect = {graph_x - 40, graph_y + graph_height - (i * max_height / 100) - 10, percentSurface->w, percentSurface->h};
-                SDL_RenderCopy(renderer, percentTexture, NULL, &percentRect);
-                SDL_FreeSurface(percentSurface);
-                SDL_DestroyTexture(percentTexture);
+                draw_text(atlas, renderer, graph_x - 40, graph_y + graph_height - (i * max_height / 100) - 10, percent_text, white);
             }
 
-            SDL_Color white = {255, 255, 255, 255};
-            SDL_Surface* titleSurface = TTF_RenderText_Solid(font, "Virtual Memory Performance", white);
-            SDL_Texture* titleTexture = SDL_CreateTextureFromSurface(renderer, titleSurface);
-            SDL_Rect titleRect = {graph_x + 200, graph_y - 70, titleSurface->w, titleSurface->h};
-            SDL_RenderCopy(renderer, titleTexture, NULL, &titleRect);
-            SDL_FreeSurface(titleSurface);
-            SDL_DestroyTexture(titleTexture);
+            draw_label(renderer, &labels[LABEL_TITLE], graph_x + 200, graph_y - 70);
 
             SDL_SetRenderDrawColor(renderer, 0, 200, 0, 255);
             int hits_height = hit_ratio * max_height;
@@ -793,129 +5658,42 @@ void visualize_and_graph(TraceEntry* trace, int trace_size, PhysicalMemory* pm,
 
             char hit_percent[16];
             snprintf(hit_percent, sizeof(hit_percent), "%.1f%%", hit_ratio * 100);
-            SDL_Surface* hitPercentSurface = TTF_RenderText_Solid(font, hit_percent, white);
-            SDL_Texture* hitPercentTexture = SDL_CreateTextureFromSurface(renderer, hitPercentSurface);
-            SDL_Rect hitPercentRect = {graph_x + 100 + bar_width/2 - hitPercentSurface->w/2,
-                                      graph_y + graph_height - hits_height - 30,
-                                      hitPercentSurface->w,
-                                      hitPercentSurface->h};
-            SDL_RenderCopy(renderer, hitPercentTexture, NULL, &hitPercentRect);
-            SDL_FreeSurface(hitPercentSurface);
-            SDL_DestroyTexture(hitPercentTexture);
+            draw_text(atlas, renderer, graph_x + 100 + bar_width/2 - text_width(atlas, hit_percent)/2,
+                      graph_y + graph_height - hits_height - 30, hit_percent, white);
 
             char miss_percent[16];
             snprintf(miss_percent, sizeof(miss_percent), "%.1f%%", miss_ratio * 100);
-            SDL_Surface* missPercentSurface = TTF_RenderText_Solid(font, miss_percent, white);
-            SDL_Texture* missPercentTexture = SDL_CreateTextureFromSurface(renderer, missPercentSurface);
-            SDL_Rect missPercentRect = {graph_x + 300 + bar_width/2 - missPercentSurface->w/2,
-                                       graph_y + graph_height - misses_height - 30,
-                                       missPercentSurface->w,
-                                       missPercentSurface->h};
-            SDL_RenderCopy(renderer, missPercentTexture, NULL, &missPercentRect);
-            SDL_FreeSurface(missPercentSurface);
-            SDL_DestroyTexture(missPercentTexture);
+            draw_text(atlas, renderer, graph_x + 300 + bar_width/2 - text_width(atlas, miss_percent)/2,
+                      graph_y + graph_height - misses_height - 30, miss_percent, white);
 
             char fault_percent[16];
             snprintf(fault_percent, sizeof(fault_percent), "%.1f%%", fault_ratio * 100);
-            SDL_Surface* faultPercentSurface = TTF_RenderText_Solid(font, fault_percent, white);
-            SDL_Texture* faultPercentTexture = SDL_CreateTextureFromSurface(renderer, faultPercentSurface);
-            SDL_Rect faultPercentRect = {graph_x + 500 + bar_width/2 - faultPercentSurface->w/2,
-                                       graph_y + graph_height - faults_height - 30,
-                                       faultPercentSurface->w,
-                                       faultPercentSurface->h};
-            SDL_RenderCopy(renderer, faultPercentTexture, NULL, &faultPercentRect);
-            SDL_FreeSurface(faultPercentSurface);
-            SDL_DestroyTexture(faultPercentTexture);
+            draw_text(atlas, renderer, graph_x + 500 + bar_width/2 - text_width(atlas, fault_percent)/2,
+                      graph_y + graph_height - faults_height - 30, fault_percent, white);
 
             SDL_SetRenderDrawColor(renderer, 0, 200, 0, 255);
             SDL_Rect legend_hits = {graph_x + 50, graph_y + graph_height + 80, 20, 20};
             SDL_RenderFillRect(renderer, &legend_hits);
-            SDL_Surface* hitsText = TTF_RenderText_Solid(font, "Hits", white);
-            SDL_Texture* hitsTexture = SDL_CreateTextureFromSurface(renderer, hitsText);
-            SDL_Rect hitsTextRect = {graph_x + 75, graph_y + graph_height + 80, hitsText->w, hitsText->h};
-            SDL_RenderCopy(renderer, hitsTexture, NULL, &hitsTextRect);
-            SDL_FreeSurface(hitsText);
-            SDL_DestroyTexture(hitsTexture);
+            draw_label(renderer, &labels[LABEL_HITS], graph_x + 75, graph_y + graph_height + 80);
 
             SDL_SetRenderDrawColor(renderer, 200, 0, 0, 255);
             SDL_Rect legend_misses = {graph_x + 200, graph_y + graph_height + 80, 20, 20};
             SDL_RenderFillRect(renderer, &legend_misses);
-            SDL_Surface* missesText = TTF_RenderText_Solid(font, "Misses", white);
-            SDL_Texture* missesTexture = SDL_CreateTextureFromSurface(renderer, missesText);
-            SDL_Rect missesTextRect = {graph_x + 225, graph_y + graph_height + 80, missesText->w, missesText->h};
-            SDL_RenderCopy(renderer, missesTexture, NULL, &missesTextRect);
-            SDL_FreeSurface(missesText);
-            SDL_DestroyTexture(missesTexture);
+            draw_label(renderer, &labels[LABEL_MISSES], graph_x + 225, graph_y + graph_height + 80);
 
             SDL_SetRenderDrawColor(renderer, 0, 0, 200, 255);
             SDL_Rect legend_faults = {graph_x + 350, graph_y + graph_height + 80, 20, 20};
             SDL_RenderFillRect(renderer, &legend_faults);
-            SDL_Surface* faultsText = TTF_RenderText_Solid(font, "Page Faults", white);
-            SDL_Texture* faultsTexture = SDL_CreateTextureFromSurface(renderer, faultsText);
-            SDL_Rect faultsTextRect = {graph_x + 375, graph_y + graph_height + 80, faultsText->w, faultsText->h};
-            SDL_RenderCopy(renderer, faultsTexture, NULL, &faultsTextRect);
-            SDL_FreeSurface(faultsText);
-            SDL_DestroyTexture(faultsTexture);
+            draw_label(renderer, &labels[LABEL_FAULTS], graph_x + 375, graph_y + graph_height + 80);
 
             // Instructions
-            SDL_Surface* instructionSurface = TTF_RenderText_Solid(font, "Press SPACE to view animation (starts in auto mode)", white);
-            SDL_Texture* instructionTexture = SDL_CreateTextureFromSurface(renderer, instructionSurface);
-            SDL_Rect instructionRect = {graph_x + 150, graph_y + graph_height + 130, instructionSurface->w, instructionSurface->h};
-            SDL_RenderCopy(renderer, instructionTexture, NULL, &instructionRect);
-            SDL_FreeSurface(instructionSurface);
-            SDL_DestroyTexture(instructionTexture);
+            draw_label(renderer, &labels[LABEL_INSTRUCTIONS], graph_x + 150, graph_y + graph_height + 130);
 
         } else if (show_animation) {
-            int frame_width = 80;
-            int frame_height = 80;
-            int cols = 10;
-            int rows = (pm->size + cols - 1) / cols;
-
             // Draw title
-            SDL_Color white = {255, 255, 255, 255};
-            SDL_Surface* animTitleSurface = TTF_RenderText_Solid(font, "Physical Memory Frames", white);
-            SDL_Texture* animTitleTexture = SDL_CreateTextureFromSurface(renderer, animTitleSurface);
-            SDL_Rect animTitleRect = {50, 30, animTitleSurface->w, animTitleSurface->h};
-            SDL_RenderCopy(renderer, animTitleTexture, NULL, &animTitleRect);
-            SDL_FreeSurface(animTitleSurface);
-            SDL_DestroyTexture(animTitleTexture);
-
-            // Draw the frames
-            for (int i = 0; i < pm->size; i++) {
-                int x = 50 + (i % cols) * frame_width;
-                int y = 70 + (i / cols) * frame_height;
-
-                SDL_Rect frame = {x, y, frame_width - 10, frame_height - 10};
-
-                if (pm->frames[i] == -1 || !pt->entries[i].valid) {
-                    SDL_SetRenderDrawColor(renderer, 128, 128, 128, 255);
-                } else if (i == last_accessed_frame) {
-                    if (last_result == 0) {
-                        SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255); // Bright green for hit
-                    } else {
-                        SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255); // Bright red for miss
-                    }
-                } else {
-                    SDL_SetRenderDrawColor(renderer, 0, 100, 200, 255);
-                }
+            draw_label(renderer, &labels[LABEL_FRAMES], 50, 30);
 
-                SDL_RenderFillRect(renderer, &frame);
-
-                // Frame border
-                SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-                SDL_RenderDrawRect(renderer, &frame);
-
-                // Draw frame number
-                char frameNum[8];
-                snprintf(frameNum, sizeof(frameNum), "F%d", i);
-                SDL_Surface* frameNumSurface = TTF_RenderText_Solid(font, frameNum, white);
-                SDL_Texture* frameNumTexture = SDL_CreateTextureFromSurface(renderer, frameNumSurface);
-                SDL_Rect frameNumRect = {x + 5, y + 5, frameNumSurface->w, frameNumSurface->h};
-                SDL_RenderCopy(renderer, frameNumTexture, NULL, &frameNumRect);
-                SDL_FreeSurface(frameNumSurface);
-                SDL_DestroyTexture(frameNumTexture);
-
-            }
+            frame_view_draw(view, renderer, atlas, snapshot);
 
             // Status bar at the bottom
             int status_bar_height = 150;
@@ -928,126 +5706,960 @@ void visualize_and_graph(TraceEntry* trace, int trace_size, PhysicalMemory* pm,
             // Display current step information
             char step_str[32];
             snprintf(step_str, sizeof(step_str), "Step: %d / %d", step, trace_size);
-            SDL_Surface* stepSurface = TTF_RenderText_Solid(font, step_str, white);
-            SDL_Texture* stepTexture = SDL_CreateTextureFromSurface(renderer, stepSurface);
-            SDL_Rect stepRect = {50, status_bar_y + 20, stepSurface->w, stepSurface->h};
-            SDL_RenderCopy(renderer, stepTexture, NULL, &stepRect);
-            SDL_FreeSurface(stepSurface);
-            SDL_DestroyTexture(stepTexture);
+            draw_text(atlas, renderer, 50, status_bar_y + 20, step_str, white);
 
             // Display current page being accessed
             char page_str[32];
-            snprintf(page_str, sizeof(page_str), "Page: %d", step > 0 && step <= trace_size ? (int)trace[step-1].address : 0);
-            SDL_Surface* pageSurface = TTF_RenderText_Solid(font, page_str, white);
-            SDL_Texture* pageTexture = SDL_CreateTextureFromSurface(renderer, pageSurface);
-            SDL_Rect pageRect = {50, status_bar_y + 50, pageSurface->w, pageSurface->h};
-            SDL_RenderCopy(renderer, pageTexture, NULL, &pageRect);
-            SDL_FreeSurface(pageSurface);
-            SDL_DestroyTexture(pageTexture);
+            snprintf(page_str, sizeof(page_str), "Page: %llu", step > 0 && step <= trace_size ? (unsigned long long)(trace[step-1].address >> sim->page_shift) : 0ull);
+            draw_text(atlas, renderer, 50, status_bar_y + 50, page_str, white);
 
             // Display access result (hit or miss)
-            char access_str[32];
             if (step > 0) {
-                snprintf(access_str, sizeof(access_str), "Result: %s", last_result == 0 ? "HIT" : "MISS");
-                SDL_Color result_color = last_result == 0 ?
+                SDL_Color result_color = snapshot->last_hit ?
                     (SDL_Color){0, 255, 0, 255} : // Green for hit
                     (SDL_Color){255, 0, 0, 255};  // Red for miss
-                SDL_Surface* accessSurface = TTF_RenderText_Solid(font, access_str, result_color);
-                SDL_Texture* accessTexture = SDL_CreateTextureFromSurface(renderer, accessSurface);
-                SDL_Rect accessRect = {50, status_bar_y + 80, accessSurface->w, accessSurface->h};
-                SDL_RenderCopy(renderer, accessTexture, NULL, &accessRect);
-                SDL_FreeSurface(accessSurface);
-                SDL_DestroyTexture(accessTexture);
+                draw_text(atlas, renderer, 50, status_bar_y + 80, snapshot->last_hit ? "Result: HIT" : "Result: MISS", result_color);
             }
 
-            // Hit/Miss statistics
+            // Hit/Miss statistics, centred in their boxes
             char hits_str[32];
-            snprintf(hits_str, sizeof(hits_str), "Hits: %d", pt->hits);
+            snprintf(hits_str, sizeof(hits_str), "Hits: %lld", snapshot->hits);
             SDL_SetRenderDrawColor(renderer, 0, 200, 0, 255);
             SDL_Rect hits_stat = {300, status_bar_y + 20, 150, 25};
             SDL_RenderFillRect(renderer, &hits_stat);
-            SDL_Surface* hitsStatSurface = TTF_RenderText_Solid(font, hits_str, white);
-            SDL_Texture* hitsStatTexture = SDL_CreateTextureFromSurface(renderer, hitsStatSurface);
-            SDL_Rect hitsStatRect = {300 + (150 - hitsStatSurface->w)/2, status_bar_y + 20 + (25 - hitsStatSurface->h)/2, hitsStatSurface->w, hitsStatSurface->h};
-            SDL_RenderCopy(renderer, hitsStatTexture, NULL, &hitsStatRect);
-            SDL_FreeSurface(hitsStatSurface);
-            SDL_DestroyTexture(hitsStatTexture);
+            draw_text(atlas, renderer, 300 + (150 - text_width(atlas, hits_str))/2, status_bar_y + 20 + (25 - atlas->line_height)/2, hits_str, white);
 
             char misses_str[32];
-            snprintf(misses_str, sizeof(misses_str), "Misses: %d", pt->misses);
+            snprintf(misses_str, sizeof(misses_str), "Misses: %lld", snapshot->misses);
             SDL_SetRenderDrawColor(renderer, 200, 0, 0, 255);
             SDL_Rect misses_stat = {300, status_bar_y + 55, 150, 25};
             SDL_RenderFillRect(renderer, &misses_stat);
-            SDL_Surface* missesStatSurface = TTF_RenderText_Solid(font, misses_str, white);
-            SDL_Texture* missesStatTexture = SDL_CreateTextureFromSurface(renderer, missesStatSurface);
-            SDL_Rect missesStatRect = {300 + (150 - missesStatSurface->w)/2, status_bar_y + 55 + (25 - missesStatSurface->h)/2, missesStatSurface->w, missesStatSurface->h};
-            SDL_RenderCopy(renderer, missesStatTexture, NULL, &missesStatRect);
-            SDL_FreeSurface(missesStatSurface);
-            SDL_DestroyTexture(missesStatTexture);
+            draw_text(atlas, renderer, 300 + (150 - text_width(atlas, misses_str))/2, status_bar_y + 55 + (25 - atlas->line_height)/2, misses_str, white);
 
             char hit_ratio_str[32];
-            float hit_ratio = (pt->hits + pt->misses > 0) ? (float)pt->hits / (pt->hits + pt->misses) * 100 : 0;
+            float hit_ratio = (snapshot->hits + snapshot->misses > 0) ? (float)snapshot->hits / (snapshot->hits + snapshot->misses) * 100 : 0;
             snprintf(hit_ratio_str, sizeof(hit_ratio_str), "Hit Ratio: %.1f%%", hit_ratio);
             SDL_SetRenderDrawColor(renderer, 0, 100, 200, 255);
             SDL_Rect hit_ratio_stat = {300, status_bar_y + 90, 150, 25};
             SDL_RenderFillRect(renderer, &hit_ratio_stat);
-            SDL_Surface* hitRatioSurface = TTF_RenderText_Solid(font, hit_ratio_str, white);
-            SDL_Texture* hitRatioTexture = SDL_CreateTextureFromSurface(renderer, hitRatioSurface);
-            SDL_Rect hitRatioRect = {300 + (150 - hitRatioSurface->w)/2, status_bar_y + 90 + (25 - hitRatioSurface->h)/2, hitRatioSurface->w, hitRatioSurface->h};
-            SDL_RenderCopy(renderer, hitRatioTexture, NULL, &hitRatioRect);
-            SDL_FreeSurface(hitRatioSurface);
-            SDL_DestroyTexture(hitRatioTexture);
+            draw_text(atlas, renderer, 300 + (150 - text_width(atlas, hit_ratio_str))/2, status_bar_y + 90 + (25 - atlas->line_height)/2, hit_ratio_str, white);
 
             // Playback controls
-            char play_str[32];
-            snprintf(play_str, sizeof(play_str), "Playback: %s", auto_play ? "Auto" : "Manual");
+            const char* play_str = auto_play ? "Playback: Auto" : "Playback: Manual";
             SDL_SetRenderDrawColor(renderer, auto_play ? 0 : 255, auto_play ? 255 : 0, 0, 255);
             SDL_Rect play_status = {550, status_bar_y + 20, 180, 25};
             SDL_RenderFillRect(renderer, &play_status);
-            SDL_Surface* playSurface = TTF_RenderText_Solid(font, play_str, white);
-            SDL_Texture* playTexture = SDL_CreateTextureFromSurface(renderer, playSurface);
-            SDL_Rect playRect = {550 + (180 - playSurface->w)/2, status_bar_y + 20 + (25 - playSurface->h)/2, playSurface->w, playSurface->h};
-            SDL_RenderCopy(renderer, playTexture, NULL, &playRect);
-            SDL_FreeSurface(playSurface);
-            SDL_DestroyTexture(playTexture);
+            draw_text(atlas, renderer, 550 + (180 - text_width(atlas, play_str))/2, status_bar_y + 20 + (25 - atlas->line_height)/2, play_str, white);
 
             char speed_str[64];
-            snprintf(speed_str, sizeof(speed_str), "Speed: %s (+ faster, - slower)",
-                     animation_delay < 5 ? "Fast" : (animation_delay < 50 ? "Medium" : "Slow"));
-            SDL_Surface* speedSurface = TTF_RenderText_Solid(font, speed_str, white);
-            SDL_Texture* speedTexture = SDL_CreateTextureFromSurface(renderer, speedSurface);
-            SDL_Rect speedRect = {550, status_bar_y + 55, speedSurface->w, speedSurface->h};
-            SDL_RenderCopy(renderer, speedTexture, NULL, &speedRect);
-            SDL_FreeSurface(speedSurface);
-            SDL_DestroyTexture(speedTexture);
+            if (fast_forward) {
+                snprintf(speed_str, sizeof(speed_str), "Speed: Fast-forward (F to stop)");
+            } else {
+                snprintf(speed_str, sizeof(speed_str), "Speed: %.0f steps/s (+/-, F = Fast-forward)", steps_per_second);
+            }
+            draw_text(atlas, renderer, 550, status_bar_y + 55, speed_str, white);
 
             // Controls explanation
-            SDL_Surface* controlSurface = TTF_RenderText_Solid(font, "Controls: P = Toggle Auto/Manual, SPACE = Step in Manual", white);
-            SDL_Texture* controlTexture = SDL_CreateTextureFromSurface(renderer, controlSurface);
-            SDL_Rect controlRect = {550, status_bar_y + 90, controlSurface->w, controlSurface->h};
-            SDL_RenderCopy(renderer, controlTexture, NULL, &controlRect);
-            SDL_FreeSurface(controlSurface);
-            SDL_DestroyTexture(controlTexture);
+            draw_label(renderer, &labels[LABEL_CONTROLS], 550, status_bar_y + 90);
+            draw_label(renderer, &labels[LABEL_VIEW_CONTROLS], 50, status_bar_y + 115);
+            draw_label(renderer, &labels[LABEL_SEEK_CONTROLS], 50, status_bar_y + 135);
+
+            // Seek bar: filled up to the step shown, marked at the step asked for
+            SDL_SetRenderDrawColor(renderer, 50, 50, 50, 255);
+            SDL_RenderFillRect(renderer, &seek_bar);
+            SDL_Rect progress = seek_bar;
+            progress.w = trace_size > 0 ? (int)((long long)seek_bar.w * step / trace_size) : 0;
+            SDL_SetRenderDrawColor(renderer, 0, 100, 200, 255);
+            SDL_RenderFillRect(renderer, &progress);
+            SDL_Rect marker = {seek_bar.x + (trace_size > 0 ? (int)(seek_bar.w * position / trace_size) : 0) - 1, seek_bar.y - 3, 3, seek_bar.h + 6};
+            SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+            SDL_RenderFillRect(renderer, &marker);
+            SDL_RenderDrawRect(renderer, &seek_bar);
         }
 
+        flush_text(atlas, renderer);
         SDL_RenderPresent(renderer);
+        // Without vsync the present returns at once, so pace to ~60 FPS.
+        if (!vsync) SDL_Delay(16);
 
-        if (show_animation && auto_play && advance_step) {
-            SDL_Delay(animation_delay * 10);
-        } else {
-            SDL_Delay(16); // ~60 FPS when not in auto mode
-        }
-
-        if (step >= trace_size && auto_play) {
+        if (show_animation && step >= trace_size && auto_play) {
             SDL_Delay(500);
             show_animation = 0;
             show_graph = 1;
         }
     }
 
+    for (int i = 0; i < LABEL_COUNT; i++) {
+        if (labels[i].texture) SDL_DestroyTexture(labels[i].texture);
+    }
+    free_simulation_worker(worker);
+    free_frame_view(view);
+    free_glyph_atlas(atlas);
     TTF_CloseFont(font);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     TTF_Quit();
     SDL_Quit();
-}
\ No newline at end of file
+}
+// --self-test replays seeded random traces through the simulator and
+// through deliberately naive reference implementations, and reports every
+// count that differs. Each test returns its number of failures.
+#define SELF_TEST_SEEDS 8
+#define SELF_TEST_REFERENCES 20000
+#define SELF_TEST_PAGES 400
+
+typedef struct {
+    const char* name;
+    int (*run)(void);
+} SelfTest;
+
+typedef struct {
+    long long misses;
+    long long write_backs;
+} ReferenceCounts;
+
+static const int self_test_frames[] = {1, 2, 3, 7, 16, 61, 200};
+#define SELF_TEST_FRAME_COUNTS ((int)(sizeof(self_test_frames) / sizeof(self_test_frames[0])))
+
+// Mostly a small hot set, with sequential runs and far jumps mixed in so
+// every policy both hits and evicts; one reference in four is a store.
+// Addresses fall anywhere within their 4K page.
+static TraceEntry* self_test_trace(unsigned int seed, int count) {
+    TraceEntry* entries = (TraceEntry*)malloc(sizeof(TraceEntry) * count);
+    uint64_t run = 0;
+    for (int i = 0; i < count; i++) {
+        int kind = rand_r(&seed) % 8;
+        uint64_t page;
+        if (kind == 0) page = rand_r(&seed) % SELF_TEST_PAGES;
+        else if (kind == 1) page = run++ % SELF_TEST_PAGES;
+        else page = rand_r(&seed) % (SELF_TEST_PAGES / 16);
+        entries[i].operation = rand_r(&seed) % 4 == 0 ? 's' : 'l';
+        entries[i].asid = 0;
+        entries[i].address = page << MIN_PAGE_SHIFT | (rand_r(&seed) & ((1 << MIN_PAGE_SHIFT) - 1));
+    }
+    return entries;
+}
+
+static int self_test_check(const char* test, const char* what, unsigned int seed, int frames,
+                           long long expected, long long actual) {
+    if (expected == actual) return 0;
+    char at[32] = "";
+    if (frames > 0) snprintf(at, sizeof(at), " at %d frames", frames);
+    fprintf(stderr, "%s: %s differ with seed %u%s: expected %lld, got %lld\n",
+            test, what, seed, at, expected, actual);
+    return 1;
+}
+
+// Runs the trace through the policy's own loop and, separately, one step
+// at a time through the vtable, holding both paths to the reference.
+// prefetch, if not NULL, attaches a prefetcher to both runs.
+static int self_test_policy(const char* test, const ReplacementPolicy* policy, const PrefetchConfig* prefetch,
+                            TraceEntry* entries, int count, int frames, unsigned int seed, ReferenceCounts expected) {
+    int failures = 0;
+    for (int stepwise = 0; stepwise < 2; stepwise++) {
+        Simulator* sim = create_simulator(policy, frames, MIN_PAGE_SHIFT);
+        if (prefetch) simulator_enable_prefetch(sim, prefetch);
+        if (stepwise) {
+            int hit;
+            for (int i = 0; i < count; i++) simulate_virtual_memory_step(sim, entries, i, &hit);
+        } else {
+            simulate_virtual_memory(sim, entries, count);
+        }
+        failures += self_test_check(test, "misses", seed, frames, expected.misses, sim->pt->misses);
+        failures += self_test_check(test, "write-backs", seed, frames, expected.write_backs, sim->pt->write_backs);
+        free_simulator(sim);
+    }
+    return failures;
+}
+
+// Finds the frame holding page by scanning them all.
+static int reference_find(const uint64_t* pages, int resident, uint64_t page) {
+    for (int f = 0; f < resident; f++) {
+        if (pages[f] == page) return f;
+    }
+    return -1;
+}
+
+// LRU by timestamps: every frame remembers its last use and the victim is
+// found by scanning for the oldest.
+static ReferenceCounts reference_lru(TraceEntry* entries, int count, int frames) {
+    ReferenceCounts counts = {0, 0};
+    uint64_t* pages = (uint64_t*)malloc(sizeof(uint64_t) * frames);
+    long long* last_use = (long long*)malloc(sizeof(long long) * frames);
+    uint8_t* dirty = (uint8_t*)calloc(frames, sizeof(uint8_t));
+    int resident = 0;
+    for (int i = 0; i < count; i++) {
+        uint64_t page = trace_page(&entries[i], MIN_PAGE_SHIFT);
+        int f = reference_find(pages, resident, page);
+        if (f == -1) {
+            counts.misses++;
+            if (resident < frames) {
+                f = resident++;
+            } else {
+                f = 0;
+                for (int k = 1; k < frames; k++) {
+                    if (last_use[k] < last_use[f]) f = k;
+                }
+                counts.write_backs += dirty[f];
+            }
+            pages[f] = page;
+            dirty[f] = 0;
+        }
+        last_use[f] = i;
+        dirty[f] |= entries[i].operation == 's';
+    }
+    free(pages);
+    free(last_use);
+    free(dirty);
+    return counts;
+}
+
+// CLOCK as the textbook has it: frames in a ring filled in order, a load
+// or a hit sets the page's reference bit, and the hand clears set bits
+// until it reaches a clear one, which is the victim. Second chance keeps
+// the same ring as a queue, so it is held to this too.
+static ReferenceCounts reference_clock(TraceEntry* entries, int count, int frames) {
+    ReferenceCounts counts = {0, 0};
+    uint64_t* pages = (uint64_t*)malloc(sizeof(uint64_t) * frames);
+    uint8_t* referenced = (uint8_t*)calloc(frames, sizeof(uint8_t));
+    uint8_t* dirty = (uint8_t*)calloc(frames, sizeof(uint8_t));
+    int resident = 0;
+    int hand = 0;
+    for (int i = 0; i < count; i++) {
+        uint64_t page = trace_page(&entries[i], MIN_PAGE_SHIFT);
+        int f = reference_find(pages, resident, page);
+        if (f == -1) {
+            counts.misses++;
+            if (resident < frames) {
+                f = resident++;
+            } else {
+                while (referenced[hand]) {
+                    referenced[hand] = 0;
+                    hand = (hand + 1) % frames;
+                }
+                f = hand;
+                hand = (hand + 1) % frames;
+                counts.write_backs += dirty[f];
+            }
+            pages[f] = page;
+            dirty[f] = 0;
+        }
+        referenced[f] = 1;
+        dirty[f] |= entries[i].operation == 's';
+    }
+    free(pages);
+    free(referenced);
+    free(dirty);
+    return counts;
+}
+
+// NRU by classes: the victim is the first frame of class 2R + M 0, then 1,
+// 2 and 3, looking from the frame after the last victim.
+static int reference_nru_victim(const uint8_t* referenced, const uint8_t* dirty, int frames, int* start) {
+    for (int rank = 0; rank < 4; rank++) {
+        for (int n = 0; n < frames; n++) {
+            int candidate = (*start + n) % frames;
+            if (2 * referenced[candidate] + dirty[candidate] == rank) {
+                *start = (candidate + 1) % frames;
+                return candidate;
+            }
+        }
+    }
+    return -1;
+}
+
+// Every NRU_TICK-th reference clears all reference bits, after a hit sets
+// its page's bit but before a fault loads its page. With a degree, a
+// sequential prefetcher also loads the next pages after each fault and
+// after the first use of a prefetched page, at most half of memory at a
+// time; each of its loads counts towards the tick as a reference does.
+static ReferenceCounts reference_nru_prefetching(TraceEntry* entries, int count, int frames, int degree) {
+    ReferenceCounts counts = {0, 0};
+    uint64_t* pages = (uint64_t*)malloc(sizeof(uint64_t) * frames);
+    uint8_t* referenced = (uint8_t*)calloc(frames, sizeof(uint8_t));
+    uint8_t* dirty = (uint8_t*)calloc(frames, sizeof(uint8_t));
+    uint8_t* prefetched = (uint8_t*)calloc(frames, sizeof(uint8_t));
+    if (degree > frames / 2) degree = frames / 2;
+    int resident = 0;
+    int start = 0;
+    int references = 0;
+    for (int i = 0; i < count; i++) {
+        uint64_t page = trace_page(&entries[i], MIN_PAGE_SHIFT);
+        int store = entries[i].operation == 's';
+        int prefetch = 0;
+        int f = reference_find(pages, resident, page);
+        if (f != -1) {
+            referenced[f] = 1;
+            dirty[f] |= store;
+            if (++references == NRU_TICK) {
+                references = 0;
+                memset(referenced, 0, frames);
+            }
+            prefetch = prefetched[f];
+            prefetched[f] = 0;
+        } else {
+            counts.misses++;
+            prefetch = 1;
+        }
+
+        // Step 0 is the fault's own load, if there was a fault; the rest
+        // are prefetches.
+        for (int k = (f == -1) ? 0 : 1; prefetch && k <= degree; k++) {
+            uint64_t load = page + k;
+            if (k > 0 && reference_find(pages, resident, load) != -1) continue;
+            if (++references == NRU_TICK) {
+                references = 0;
+                memset(referenced, 0, frames);
+            }
+            int frame;
+            if (resident < frames) {
+                frame = resident++;
+            } else {
+                frame = reference_nru_victim(referenced, dirty, frames, &start);
+                counts.write_backs += dirty[frame];
+            }
+            pages[frame] = load;
+            referenced[frame] = 1;
+            dirty[frame] = k == 0 && store;
+            prefetched[frame] = k > 0;
+        }
+    }
+    free(pages);
+    free(referenced);
+    free(dirty);
+    free(prefetched);
+    return counts;
+}
+
+static ReferenceCounts reference_nru(TraceEntry* entries, int count, int frames) {
+    return reference_nru_prefetching(entries, count, frames, 0);
+}
+
+static ReferenceCounts reference_nru_sequential(TraceEntry* entries, int count, int frames) {
+    return reference_nru_prefetching(entries, count, frames, PREFETCH_DEGREE);
+}
+
+// The enhanced second-chance clock: the hand first looks a full turn for
+// a frame neither referenced nor dirty, then a full turn for one that is
+// only dirty, clearing the reference bits it passes, and repeats.
+static ReferenceCounts reference_enhanced_clock(TraceEntry* entries, int count, int frames) {
+    ReferenceCounts counts = {0, 0};
+    uint64_t* pages = (uint64_t*)malloc(sizeof(uint64_t) * frames);
+    uint8_t* referenced = (uint8_t*)calloc(frames, sizeof(uint8_t));
+    uint8_t* dirty = (uint8_t*)calloc(frames, sizeof(uint8_t));
+    int resident = 0;
+    int hand = 0;
+    for (int i = 0; i < count; i++) {
+        uint64_t page = trace_page(&entries[i], MIN_PAGE_SHIFT);
+        int f = reference_find(pages, resident, page);
+        if (f == -1) {
+            counts.misses++;
+            if (resident < frames) {
+                f = resident++;
+            } else {
+                while (f == -1) {
+                    for (int n = 0; n < frames && f == -1; n++, hand = (hand + 1) % frames) {
+                        if (!referenced[hand] && !dirty[hand]) f = hand;
+                    }
+                    for (int n = 0; n < frames && f == -1; n++, hand = (hand + 1) % frames) {
+                        if (!referenced[hand] && dirty[hand]) f = hand;
+                        referenced[hand] = 0;
+                    }
+                }
+                counts.write_backs += dirty[f];
+            }
+            pages[f] = page;
+            dirty[f] = 0;
+        }
+        referenced[f] = 1;
+        dirty[f] |= entries[i].operation == 's';
+    }
+    free(pages);
+    free(referenced);
+    free(dirty);
+    return counts;
+}
+
+// Holds a policy to its reference over every seed and frame count.
+static int self_test_reference(const char* test, const ReplacementPolicy* policy, const PrefetchConfig* prefetch,
+                               ReferenceCounts (*reference)(TraceEntry*, int, int)) {
+    int failures = 0;
+    for (unsigned int seed = 1; seed <= SELF_TEST_SEEDS; seed++) {
+        TraceEntry* entries = self_test_trace(seed, SELF_TEST_REFERENCES);
+        for (int k = 0; k < SELF_TEST_FRAME_COUNTS; k++) {
+            int frames = self_test_frames[k];
+            failures += self_test_policy(test, policy, prefetch, entries, SELF_TEST_REFERENCES, frames, seed,
+                                         reference(entries, SELF_TEST_REFERENCES, frames));
+        }
+        free(entries);
+    }
+    return failures;
+}
+
+static int self_test_lru(void) {
+    return self_test_reference("LRU", policies[1], NULL, reference_lru);
+}
+
+static int self_test_second_chance(void) {
+    return self_test_reference("Second chance", policies[3], NULL, reference_clock);
+}
+
+static int self_test_clock(void) {
+    return self_test_reference("CLOCK", policies[4], NULL, reference_clock);
+}
+
+static int self_test_nru(void) {
+    return self_test_reference("NRU", policies[9], NULL, reference_nru);
+}
+
+// Prefetch loads advance NRU's tick, so NRU is also run under the
+// sequential prefetcher.
+static int self_test_nru_prefetch(void) {
+    PrefetchConfig sequential = {PREFETCH_SEQUENTIAL, PREFETCH_DEGREE};
+    return self_test_reference("NRU, prefetching", policies[9], &sequential, reference_nru_sequential);
+}
+
+static int self_test_enhanced_clock(void) {
+    return self_test_reference("Enhanced second chance", policies[10], NULL, reference_enhanced_clock);
+}
+
+// Short traces worked through by hand from each policy's rules, pages as
+// digits and one outcome per reference, 'h' for a hit and 'm' for a miss.
+typedef struct {
+    const char* name;
+    int algorithm;
+    int frames;
+    const char* pages;
+    const char* outcomes;
+} HandTrace;
+
+static const HandTrace hand_traces[] = {
+    // T1 fills and drops its LRU page outright twice. Ghost hits on 1 and 2
+    // leave the target at 1, so with B2 trimmed on 6 and B1 on 7, 7 takes
+    // its frame from T2 and 6 still hits; 2, 7 and 6 then come back from
+    // the ghost lists, moving the target down, up and down to 0, which
+    // makes 9 take its frame from T1 and keeps 6.
+    {"ARC", 5, 2, "123113241267627676896", "mmmmhhmmmmmmhmmmhhmmh"},
+    // A1in holds one page: 1 and 2 come back from A1out into Am, the hit on
+    // 5 in A1in changes nothing, 3 and 4 fall off A1out, 6 is promoted and
+    // 8 finally pushes the LRU page 2 out of Am.
+    {"2Q", 6, 4, "12345121657346821", "mmmmmmmhmhmmmmmmh"},
+    // Two LIR frames and one HIR frame: 3 and 5 come back as ghosts on S
+    // and demote the bottom LIR page, 1 is hit as a resident HIR page off
+    // S and then again on S, which makes it LIR.
+    {"LIRS", 7, 3, "12341353251143", "mmmmhmmhmmhhmm"},
+    // 3 and 2 are re-referenced during their test periods and come back
+    // hot; 5 is hit while cold under test and is promoted by HAND_cold.
+    {"CLOCK-Pro", 8, 3, "123413525142", "mmmmhmmmhhmm"},
+};
+
+static int self_test_hand_traces(void) {
+    int failures = 0;
+    for (size_t t = 0; t < sizeof(hand_traces) / sizeof(hand_traces[0]); t++) {
+        const HandTrace* trace = &hand_traces[t];
+        int count = (int)strlen(trace->pages);
+        TraceEntry* entries = (TraceEntry*)malloc(sizeof(TraceEntry) * count);
+        long long misses = 0;
+        for (int i = 0; i < count; i++) {
+            entries[i].operation = 'l';
+            entries[i].asid = 0;
+            entries[i].address = (uint64_t)(trace->pages[i] - '0') << MIN_PAGE_SHIFT;
+            misses += trace->outcomes[i] == 'm';
+        }
+        Simulator* sim = create_simulator(policies[trace->algorithm], trace->frames, MIN_PAGE_SHIFT);
+        for (int i = 0; i < count; i++) {
+            int hit;
+            simulate_virtual_memory_step(sim, entries, i, &hit);
+            if (hit != (trace->outcomes[i] == 'h')) {
+                fprintf(stderr, "%s: reference %d to page %c should be a %s\n", trace->name, i + 1,
+                        trace->pages[i], hit ? "miss" : "hit");
+                failures++;
+                break;
+            }
+        }
+        free_simulator(sim);
+        ReferenceCounts expected = {misses, 0};
+        failures += self_test_policy(trace->name, policies[trace->algorithm], NULL, entries, count, trace->frames, 0,
+                                     expected);
+        free(entries);
+    }
+    return failures;
+}
+
+// Counts the nodes on a list, or returns -1 if a link or list tag is
+// wrong, or a node's residency is not the expected one (-1 for either).
+static int self_test_walk(const NodeList* list, const int* prev, const int* next, const int* tags, int tag,
+                          const int* frames, int resident, int capacity) {
+    int count = 0;
+    int last = -1;
+    for (int node = list->head; node != -1; node = next[node]) {
+        if (++count > capacity || prev[node] != last || tags[node] != tag) return -1;
+        if (resident != -1 && (frames[node] != -1) != resident) return -1;
+        last = node;
+    }
+    return last == list->tail && count == list->length ? count : -1;
+}
+
+static int arc_lists_consistent(ArcQueue* arc, int resident) {
+    PageNodes* nodes = arc->nodes;
+    int length[4];
+    for (int i = 0; i < 4; i++) {
+        length[i] = self_test_walk(&arc->lists[i], nodes->prev, nodes->next, nodes->lists, i, nodes->frames,
+                                   i == ARC_T1 || i == ARC_T2, nodes->capacity);
+        if (length[i] == -1) return 0;
+    }
+    return length[ARC_T1] + length[ARC_T2] == resident && length[ARC_T1] + length[ARC_B1] <= arc->size &&
+           length[ARC_T1] + length[ARC_T2] + length[ARC_B1] + length[ARC_B2] <= 2 * arc->size &&
+           arc->target >= 0 && arc->target <= arc->size;
+}
+
+static int twoq_lists_consistent(TwoQQueue* twoq, int resident) {
+    PageNodes* nodes = twoq->nodes;
+    int length[3];
+    for (int i = 0; i < 3; i++) {
+        length[i] = self_test_walk(&twoq->lists[i], nodes->prev, nodes->next, nodes->lists, i, nodes->frames,
+                                   i != TWOQ_A1OUT, nodes->capacity);
+        if (length[i] == -1) return 0;
+    }
+    return length[TWOQ_A1IN] + length[TWOQ_AM] == resident && length[TWOQ_A1OUT] <= twoq->out_limit;
+}
+
+// Every LIR page is resident and on S, with one at the bottom; Q holds the
+// other resident pages and the ghost list the non-resident ones on S.
+static int lirs_lists_consistent(LirsQueue* lirs, int resident) {
+    PageNodes* nodes = lirs->nodes;
+    int stack = self_test_walk(&lirs->stack, nodes->prev, nodes->next, nodes->lists, LIRS_STACK, nodes->frames,
+                               -1, nodes->capacity);
+    int queue = self_test_walk(&lirs->queues[LIRS_QUEUE], lirs->queue_prev, lirs->queue_next, lirs->queue_lists,
+                               LIRS_QUEUE, nodes->frames, 1, nodes->capacity);
+    int ghosts = self_test_walk(&lirs->queues[LIRS_GHOSTS], lirs->queue_prev, lirs->queue_next,
+                                lirs->queue_lists, LIRS_GHOSTS, nodes->frames, 0, nodes->capacity);
+    if (stack == -1 || queue == -1 || ghosts == -1) return 0;
+    int lir = 0;
+    for (int node = lirs->stack.head; node != -1; node = nodes->next[node]) {
+        if (lirs->status[node] == LIRS_LIR) lir++;
+        if (lirs->status[node] == LIRS_GHOST) ghosts--;
+        if ((lirs->status[node] == LIRS_GHOST) != (lirs->queue_lists[node] == LIRS_GHOSTS)) return 0;
+    }
+    if (ghosts != 0) return 0;
+    if (lirs->stack.tail != -1 && lirs->status[lirs->stack.tail] != LIRS_LIR) return 0;
+    return lir == lirs->lir_count && lir <= lirs->lir_limit && lir + queue == resident &&
+           lirs->queues[LIRS_GHOSTS].length <= lirs->ghost_limit;
+}
+
+// One ring through every known page, with the hot and non-resident counts
+// matching it and non-resident pages only while under test.
+static int clock_pro_lists_consistent(ClockProQueue* cp, int resident) {
+    PageNodes* nodes = cp->nodes;
+    int count = 0;
+    int on_ring = 0;
+    int hot = 0;
+    int nonresident = 0;
+    int hands = cp->hand_hot == -1 ? 3 : 0;
+    int node = cp->hand_hot;
+    while (node != -1) {
+        if (++count > nodes->capacity || nodes->prev[nodes->next[node]] != node) return 0;
+        if (nodes->frames[node] != -1) on_ring++;
+        else if (cp->hot[node] || !cp->test[node]) return 0;
+        else nonresident++;
+        hot += cp->hot[node];
+        hands += (node == cp->hand_hot) + (node == cp->hand_cold) + (node == cp->hand_test);
+        node = nodes->next[node];
+        if (node == cp->hand_hot) break;
+    }
+    int max_cold = cp->size > 2 ? cp->size - 1 : 1;
+    return hands == 3 && on_ring == resident && hot == cp->hot_count && nonresident == cp->nonresident_count &&
+           nonresident <= cp->size && cp->cold_target >= 1 && cp->cold_target <= max_cold;
+}
+
+static int self_test_lists_consistent(int algorithm, Simulator* sim) {
+    int resident = sim->pm->next_frame;
+    switch (algorithm) {
+        case 5: return arc_lists_consistent((ArcQueue*)sim->state, resident);
+        case 6: return twoq_lists_consistent((TwoQQueue*)sim->state, resident);
+        case 7: return lirs_lists_consistent((LirsQueue*)sim->state, resident);
+        default: return clock_pro_lists_consistent((ClockProQueue*)sim->state, resident);
+    }
+}
+
+// Steps ARC, 2Q, LIRS and CLOCK-Pro through every seed and frame count and
+// checks their resident and ghost lists after each reference.
+static int self_test_policy_lists(void) {
+    int failures = 0;
+    for (unsigned int seed = 1; seed <= SELF_TEST_SEEDS; seed++) {
+        TraceEntry* entries = self_test_trace(seed, SELF_TEST_REFERENCES);
+        for (int algorithm = 5; algorithm <= 8; algorithm++) {
+            for (int k = 0; k < SELF_TEST_FRAME_COUNTS; k++) {
+                int frames = self_test_frames[k];
+                Simulator* sim = create_simulator(policies[algorithm], frames, MIN_PAGE_SHIFT);
+                for (int i = 0; i < SELF_TEST_REFERENCES; i++) {
+                    int hit;
+                    simulate_virtual_memory_step(sim, entries, i, &hit);
+                    if (!self_test_lists_consistent(algorithm, sim)) {
+                        fprintf(stderr, "%s: lists inconsistent after reference %d with seed %u at %d frames\n",
+                                algorithm_names[algorithm], i + 1, seed, frames);
+                        failures++;
+                        break;
+                    }
+                }
+                free_simulator(sim);
+            }
+        }
+        free(entries);
+    }
+    return failures;
+}
+
+// Both miss curves against the simulated LRU and MIN at each frame count.
+static int self_test_curves(void) {
+    int failures = 0;
+    int max_frames = self_test_frames[SELF_TEST_FRAME_COUNTS - 1];
+    for (unsigned int seed = 1; seed <= SELF_TEST_SEEDS; seed++) {
+        TraceEntry* entries = self_test_trace(seed, SELF_TEST_REFERENCES);
+        long long* next_use = compute_next_use(entries, SELF_TEST_REFERENCES, MIN_PAGE_SHIFT);
+        for (int algorithm = 1; algorithm <= 2; algorithm++) {
+            TraceStream* stream = open_memory_trace_stream(entries, SELF_TEST_REFERENCES, LOOKAHEAD_NONE, MIN_PAGE_SHIFT);
+            MissCurve* curve = (algorithm == 1) ? lru_miss_curve(stream, max_frames)
+                                                : opt_miss_curve(stream, max_frames);
+            close_trace_stream(stream);
+            long long hits = 0;
+            int k = 0;
+            for (int frames = 1; frames <= max_frames; frames++) {
+                hits += curve->distance_counts[frames];
+                if (frames != self_test_frames[k]) continue;
+                k++;
+                Simulator* sim = create_simulator(policies[algorithm], frames, MIN_PAGE_SHIFT);
+                simulator_set_lookahead(sim, next_use);
+                simulate_virtual_memory(sim, entries, SELF_TEST_REFERENCES);
+                failures += self_test_check(algorithm == 1 ? "LRU curve" : "MIN curve", "misses", seed, frames,
+                                            sim->pt->misses, curve->references - hits);
+                free_simulator(sim);
+            }
+            free_miss_curve(curve);
+        }
+        free(next_use);
+        free(entries);
+    }
+    return failures;
+}
+
+// Working set and PFF straight from their definitions, over the self-test
+// pages: the working set after reference t is every page last used after
+// t - tau, found by checking them all; PFF on a fault more than tau after
+// the previous one drops every page not used since it.
+static int self_test_allocator_kind(int kind, long long tau, TraceEntry* entries, int count, unsigned int seed) {
+    char test[48];
+    snprintf(test, sizeof(test), "%s, tau %lld", kind == ALLOCATOR_PFF ? "PFF" : "Working set", tau);
+    long long last_use[SELF_TEST_PAGES];
+    uint8_t resident[SELF_TEST_PAGES] = {0};
+    for (int p = 0; p < SELF_TEST_PAGES; p++) last_use[p] = -1;
+    long long faults = 0, resident_sum = 0, last_fault = -1;
+    int max_resident = 0;
+
+    AllocatorConfig config = {kind, tau};
+    ResidentSetAllocator* allocator = create_resident_set_allocator(&config, 0);
+    for (int t = 0; t < count; t++) {
+        int page = (int)trace_page(&entries[t], MIN_PAGE_SHIFT);
+        resident_set_access(allocator, (uint64_t)page);
+        if (kind == ALLOCATOR_WORKING_SET) {
+            if (last_use[page] == -1 || last_use[page] <= t - 1 - tau) faults++;
+            last_use[page] = t;
+            for (int p = 0; p < SELF_TEST_PAGES; p++) resident[p] = last_use[p] != -1 && last_use[p] > t - tau;
+        } else {
+            if (!resident[page]) {
+                if (last_fault != -1 && t - last_fault > tau) {
+                    for (int p = 0; p < SELF_TEST_PAGES; p++) {
+                        if (last_use[p] < last_fault) resident[p] = 0;
+                    }
+                }
+                last_fault = t;
+                faults++;
+                resident[page] = 1;
+            }
+            last_use[page] = t;
+        }
+        int size = 0;
+        for (int p = 0; p < SELF_TEST_PAGES; p++) size += resident[p];
+        resident_sum += size;
+        if (size > max_resident) max_resident = size;
+    }
+
+    int failures = 0;
+    failures += self_test_check(test, "faults", seed, 0, faults, allocator->faults);
+    failures += self_test_check(test, "resident sums", seed, 0, resident_sum, allocator->resident_sum);
+    failures += self_test_check(test, "peak resident sets", seed, 0, max_resident, allocator->max_resident);
+    free_resident_set_allocator(allocator);
+    return failures;
+}
+
+static int self_test_allocators(void) {
+    static const long long taus[] = {1, 2, 5, 40, 1000};
+    int failures = 0;
+    for (unsigned int seed = 1; seed <= SELF_TEST_SEEDS; seed++) {
+        TraceEntry* entries = self_test_trace(seed, SELF_TEST_REFERENCES);
+        for (size_t k = 0; k < sizeof(taus) / sizeof(taus[0]); k++) {
+            failures += self_test_allocator_kind(ALLOCATOR_WORKING_SET, taus[k], entries, SELF_TEST_REFERENCES, seed);
+            failures += self_test_allocator_kind(ALLOCATOR_PFF, taus[k], entries, SELF_TEST_REFERENCES, seed);
+        }
+        free(entries);
+    }
+    return failures;
+}
+
+// Reads a binary trace back and counts the entries whose page differs from
+// the original; *read is how many entries came back.
+static int self_test_read_back(const char* path, TraceEntry* entries, int count, int* read) {
+    TraceStream* stream = open_trace_stream(path, LOOKAHEAD_NONE, 0, MIN_PAGE_SHIFT);
+    if (!stream || !stream->mapped) {
+        if (stream) close_trace_stream(stream);
+        *read = -1;
+        return 1;
+    }
+    stream->quiet = 1;
+    int differing = 0;
+    *read = 0;
+    while (trace_stream_next(stream) > 0) {
+        for (int i = 0; i < stream->chunk_size && *read < count; i++, (*read)++) {
+            TraceEntry* entry = &stream->chunk[i];
+            differing += entry->address != entries[*read].address || entry->asid != entries[*read].asid
+                         || entry->operation != entries[*read].operation;
+        }
+    }
+    close_trace_stream(stream);
+    return differing;
+}
+
+// Round trip through the binary format with ASID switches wide enough to
+// need the tenth varint byte, then again with the last record cut short,
+// which must end the trace one entry early. The trace is written with
+// one-byte pages, so every address and ASID must come back exactly.
+static int self_test_binary_trace(void) {
+    int failures = 0;
+    char path[] = "/tmp/vmsim-self-test-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("Failed to create a temporary trace");
+        return 1;
+    }
+    close(fd);
+    for (unsigned int seed = 1; seed <= SELF_TEST_SEEDS; seed++) {
+        TraceEntry* entries = self_test_trace(seed, SELF_TEST_REFERENCES);
+        unsigned int state = seed;
+        for (int i = 0; i < SELF_TEST_REFERENCES; i++) {
+            int kind = rand_r(&state) % 4;
+            if (kind == 0) entries[i].asid = (uint16_t)(rand_r(&state) & 0xffff);
+            else if (kind == 1) entries[i].asid = (uint16_t)(i & 1 ? 0xffff : 0);
+            if (rand_r(&state) % 8 == 0) entries[i].address |= (uint64_t)rand_r(&state) << 16;
+        }
+        entries[SELF_TEST_REFERENCES - 2].asid = 0;
+        entries[SELF_TEST_REFERENCES - 2].address = 0;
+        entries[SELF_TEST_REFERENCES - 1].asid = 0xffff;
+        entries[SELF_TEST_REFERENCES - 1].address = PAGE_KEY_MASK;
+
+        TraceWriter* writer = open_trace_writer(path, 1);
+        for (int i = 0; i < SELF_TEST_REFERENCES; i++) trace_writer_append(writer, &entries[i]);
+        close_trace_writer(writer);
+        int read;
+        failures += self_test_check("Binary trace", "pages", seed, 0, 0,
+                                    self_test_read_back(path, entries, SELF_TEST_REFERENCES, &read));
+        failures += self_test_check("Binary trace", "entries", seed, 0, SELF_TEST_REFERENCES, read);
+
+        struct stat st;
+        if (stat(path, &st) != 0 || truncate(path, st.st_size - 1) != 0) {
+            failures++;
+        } else {
+            failures += self_test_check("Binary trace", "truncated pages", seed, 0, 0,
+                                        self_test_read_back(path, entries, SELF_TEST_REFERENCES, &read));
+            failures += self_test_check("Binary trace", "truncated entries", seed, 0, SELF_TEST_REFERENCES - 1, read);
+        }
+        free(entries);
+    }
+    unlink(path);
+    return failures;
+}
+
+#define SELF_TEST_WORKER_FRAMES 64
+#define SELF_TEST_WORKER_STEPS (4 * WORKER_BATCH + 123)
+
+// Seeks the worker forward and back from this thread, as the UI does, and
+// checks every fresh snapshot against a second simulator stepped to the
+// same step. The UI's copy of the heat is rebuilt from the change lists
+// alone, so a lost or torn handoff shows up as a difference. Build with
+// -fsanitize=thread to have the handoff itself checked for races.
+static int self_test_worker(void) {
+    int failures = 0;
+    int frames = SELF_TEST_WORKER_FRAMES;
+    int count = SELF_TEST_WORKER_STEPS;
+    int targets[] = {count, count / 3, count / 3 + 1, 0, count - 1, WORKER_BATCH, count / 2};
+    uint32_t* heat = (uint32_t*)calloc(frames, sizeof(uint32_t));
+    uint32_t* shown = (uint32_t*)calloc(frames, sizeof(uint32_t));
+    uint32_t* steps = (uint32_t*)malloc(sizeof(uint32_t) * count);
+    for (unsigned int seed = 1; seed <= 2; seed++) {
+        TraceEntry* entries = self_test_trace(seed, count);
+        Simulator* sim = create_simulator(policies[1], frames, MIN_PAGE_SHIFT);
+        sim->steps = steps;
+        simulate_virtual_memory(sim, entries, count);
+        free_simulator(sim);
+        SimulationWorker* worker = create_simulation_worker(steps, count, frames, NULL);
+        Simulator* replay = NULL;
+        int replayed = 0, last_frame = -1, last_hit = 0;
+        memset(shown, 0, sizeof(uint32_t) * frames);
+        for (size_t t = 0; t < sizeof(targets) / sizeof(targets[0]); t++) {
+            simulation_worker_seek(worker, targets[t]);
+            SimulationSnapshot* snapshot;
+            do {
+                int fresh;
+                snapshot = simulation_worker_acquire(worker, &fresh);
+                if (!fresh) continue;
+                if (!replay || snapshot->step < replayed) {
+                    if (replay) free_simulator(replay);
+                    replay = create_simulator(policies[1], frames, MIN_PAGE_SHIFT);
+                    memset(heat, 0, sizeof(uint32_t) * frames);
+                    replayed = 0;
+                    last_frame = -1;
+                    last_hit = 0;
+                }
+                for (; replayed < snapshot->step; replayed++) {
+                    last_frame = simulate_virtual_memory_step(replay, entries, replayed, &last_hit);
+                    heat[last_frame] = last_hit ? heat[last_frame] + 1 : 1;
+                }
+                if (snapshot->refresh) {
+                    memcpy(shown, snapshot->heat, sizeof(uint32_t) * frames);
+                } else {
+                    for (int k = 0; k < snapshot->touched_count; k++) {
+                        shown[snapshot->touched[k]] = snapshot->heat[snapshot->touched[k]];
+                    }
+                }
+                failures += self_test_check("Worker", "hits", seed, 0, replay->pt->hits, snapshot->hits);
+                failures += self_test_check("Worker", "misses", seed, 0, replay->pt->misses, snapshot->misses);
+                failures += self_test_check("Worker", "heat", seed, 0, 0, memcmp(heat, snapshot->heat, sizeof(uint32_t) * frames) != 0);
+                failures += self_test_check("Worker", "change lists", seed, 0, 0, memcmp(shown, snapshot->heat, sizeof(uint32_t) * frames) != 0);
+                failures += self_test_check("Worker", "last frames", seed, 0, last_frame, snapshot->last_frame);
+                failures += self_test_check("Worker", "last results", seed, 0, last_hit, snapshot->last_hit);
+            } while (snapshot->step != targets[t] && failures == 0);
+        }
+        free_simulation_worker(worker);
+        if (replay) free_simulator(replay);
+        free(entries);
+    }
+    free(steps);
+    free(heat);
+    free(shown);
+    return failures;
+}
+
+// Seeks the worker to target and holds the snapshot to a fresh run of the
+// same policy, one step at a time up to target. Its heat is worked out
+// from the run itself, a prefetched page counting as loaded at its first
+// use, so a seek must show exactly what playing forward to target shows.
+static int self_test_seek_to(const char* test, SimulationWorker* worker, const ReplacementPolicy* policy,
+                             const PrefetchConfig* prefetch, TraceEntry* entries, long long* next_use,
+                             int frames, int target, unsigned int seed) {
+    simulation_worker_seek(worker, target);
+    SimulationSnapshot* snapshot;
+    do {
+        int fresh;
+        snapshot = simulation_worker_acquire(worker, &fresh);
+    } while (snapshot->step != target);
+
+    Simulator* reference = create_simulator(policy, frames, MIN_PAGE_SHIFT);
+    simulator_set_lookahead(reference, next_use);
+    if (prefetch) simulator_enable_prefetch(reference, prefetch);
+    uint32_t* heat = (uint32_t*)calloc(frames, sizeof(uint32_t));
+    int last_frame = -1, last_hit = 0;
+    for (int i = 0; i < target; i++) {
+        int frame = page_index_lookup(reference->pt->index, trace_page(&entries[i], MIN_PAGE_SHIFT));
+        int prefetched = frame != -1 && prefetch && reference->prefetcher->prefetched[frame];
+        last_frame = simulate_virtual_memory_step(reference, entries, i, &last_hit);
+        heat[last_frame] = last_hit && !prefetched ? heat[last_frame] + 1 : 1;
+    }
+
+    int failures = 0;
+    failures += self_test_check(test, "hits", seed, frames, reference->pt->hits, snapshot->hits);
+    failures += self_test_check(test, "misses", seed, frames, reference->pt->misses, snapshot->misses);
+    failures += self_test_check(test, "heat", seed, frames, 0, memcmp(heat, snapshot->heat, sizeof(uint32_t) * frames) != 0);
+    if (!prefetch) {
+        int resident = 0;
+        for (int frame = 0; frame < frames; frame++) resident += (snapshot->heat[frame] != 0) == reference->pt->valid[frame];
+        failures += self_test_check(test, "resident frames", seed, frames, frames, resident);
+    }
+    failures += self_test_check(test, "last frames", seed, frames, last_frame, snapshot->last_frame);
+    failures += self_test_check(test, "last results", seed, frames, last_hit, snapshot->last_hit);
+    free(heat);
+    free_simulator(reference);
+    return failures;
+}
+
+// Animation seeks forward, back and onto checkpoints for every policy,
+// with checkpoints and without, and with the sequential prefetcher where
+// the policy allows it.
+static int self_test_seek(void) {
+    int failures = 0;
+    int frames = 61;
+    int count = SELF_TEST_REFERENCES;
+    PrefetchConfig sequential = {PREFETCH_SEQUENTIAL, PREFETCH_DEGREE};
+    uint32_t* steps = (uint32_t*)malloc(sizeof(uint32_t) * count);
+    for (unsigned int seed = 1; seed <= 2; seed++) {
+        TraceEntry* entries = self_test_trace(seed, count);
+        for (int algorithm = 0; algorithm < NUM_ALGORITHMS; algorithm++) {
+            const ReplacementPolicy* policy = policies[algorithm];
+            long long* next_use = policy->set_lookahead ? compute_next_use(entries, count, MIN_PAGE_SHIFT) : NULL;
+            for (int prefetching = 0; prefetching < 2 && !(prefetching && next_use); prefetching++) {
+                const PrefetchConfig* prefetch = prefetching ? &sequential : NULL;
+                char test[48];
+                snprintf(test, sizeof(test), "Seek, %s%s", algorithm_names[algorithm], prefetching ? ", prefetching" : "");
+
+                Simulator* sim = create_simulator(policy, frames, MIN_PAGE_SHIFT);
+                simulator_set_lookahead(sim, next_use);
+                if (prefetch) simulator_enable_prefetch(sim, prefetch);
+                sim->steps = steps;
+                simulate_virtual_memory(sim, entries, count);
+                free_simulator(sim);
+                Checkpoints* checkpoints = create_checkpoints(steps, count, frames);
+
+                int interval = checkpoints->interval;
+                int targets[] = {count, 5000, count / 2 + 1, 0, 3 * interval, 3 * interval - 1, 3 * interval + 1, count - 1};
+                for (int with_checkpoints = 0; with_checkpoints < 2; with_checkpoints++) {
+                    SimulationWorker* worker = create_simulation_worker(steps, count, frames,
+                                                                        with_checkpoints ? checkpoints : NULL);
+                    for (size_t t = 0; t < sizeof(targets) / sizeof(targets[0]); t++) {
+                        failures += self_test_seek_to(test, worker, policy, prefetch, entries, next_use, frames,
+                                                      targets[t], seed);
+                    }
+                    free_simulation_worker(worker);
+                }
+                free_checkpoints(checkpoints);
+            }
+            free(next_use);
+        }
+        free(entries);
+    }
+    free(steps);
+    return failures;
+}
+
+static const SelfTest self_tests[] = {
+    {"LRU", self_test_lru},
+    {"Second chance", self_test_second_chance},
+    {"CLOCK", self_test_clock},
+    {"NRU", self_test_nru},
+    {"NRU, prefetching", self_test_nru_prefetch},
+    {"Enhanced second chance", self_test_enhanced_clock},
+    {"Hand-worked traces", self_test_hand_traces},
+    {"Policy lists", self_test_policy_lists},
+    {"Miss curves", self_test_curves},
+    {"Working set and PFF", self_test_allocators},
+    {"Binary trace", self_test_binary_trace},
+    {"Worker handoff", self_test_worker},
+    {"Seeking", self_test_seek},
+};
+
+int run_self_tests(void) {
+    int failures = 0;
+    for (size_t t = 0; t < sizeof(self_tests) / sizeof(self_tests[0]); t++) {
+        int failed = self_tests[t].run();
+        printf("%-24s %s\n", self_tests[t].name, failed ? "FAILED" : "ok");
+        failures += failed;
+    }
+    return failures;
+}